@@ -24,6 +24,10 @@
 #include "stb_image.h"
 #include "scolor.hpp"
 #include "base_class.h"
+#include "scheduler.h"
+#include "headless.h"
+#include "profiler.h"
+#include "histogram.h"
 
 #define _USE_MATH_DEFINES
 #define GRAVITY 0.015f
@@ -31,6 +35,15 @@
 
 std::mutex grand_mutex;
 
+/* Everything drawn, one per loaded object plus the floor */
+std::vector<renderable*> renderers;
+
+/* Simulated, and drawn from its snapshots */
+void add_object(loaded_object* o) {
+	objects.push_back(o);
+	renderers.push_back(new object_renderer(*o));
+}
+
 GLuint make_shader(const char* filename, GLenum shaderType) {
 	FILE* fd = fopen(filename, "r");
 	if (fd == 0) {
@@ -85,6 +98,7 @@ GLuint make_program(const char* v_file, const char* tcs_file, const char* tes_fi
 
 
 	unsigned int program = glCreateProgram();
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);	// For the program cache
 	glAttachShader(program, vs_reference);
 	if (g_file)
 		glAttachShader(program, gs_reference);
@@ -106,15 +120,6 @@ GLuint make_program(const char* v_file, const char* tcs_file, const char* tes_fi
 	return program;
 }
 
-struct key_status {
-	int forward, backward, left, right;
-};
-struct key_status player_key_status;
-
-void fire(bool burst = false){
-	ice_balls.add_projectile(player_position, player_heading, player_elevation, 1.6f, 10000.0f, 1.0f, burst);
-}
-
 void mouse_click_callback(GLFWwindow* window, int button, int action, int mods){
 	if(button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
 		fire();//non burst
@@ -139,6 +144,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		player_key_status.left = action;
 	if(GLFW_KEY_D == key)
 		player_key_status.right = action;
+	if(GLFW_KEY_F9 == key && 1 == action)	// Only does anything built with -DPROFILE
+		PROFILE_WRITE_TRACE("trace.json");
 	if(GLFW_KEY_SPACE == key && 1 == action){
 		if(player_platform || player_position.y == player_height){ // this only works since floor height is 0
 			player_fall_speed = 0.65f;
@@ -149,142 +156,15 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 }
 
 
-long is_empty(glm::vec3 position, float distance){
-        for(gameobject* o : objects) {
-                long collide_index = o->collision_index(position, 0.2f);
-                if(collide_index != -1)
-                        return false;
-        }
-        return true;
-
+std::atomic<int> shutdown_engine(0);
+/* 1 ms ticks, catching up on at most 5 at a time */
+tick_scheduler sim_scheduler(std::chrono::microseconds(1000), 5);
+void simulation(){
+	PROFILE_THREAD("simulation");
+	add_sim_phases(sim_scheduler);
+	sim_scheduler.run(shutdown_engine);
 }
 
-int shutdown_engine = 0;
-/* Must be called at a consistent rate */
-void player_movement(){
-	while(!shutdown_engine){
-//		grand_mutex.lock();
-		auto start = std::chrono::system_clock::now();
-		glm::vec3 step_to_point = player_position;
-		if(player_key_status.forward){
-			step_to_point += player_speed * glm::vec3(sinf(player_heading), 0, cosf(player_heading));
-		}
-		if(player_key_status.backward){
-			step_to_point += player_speed * glm::vec3(-sinf(player_heading), 0, -cosf(player_heading));
-		}
-		if(player_key_status.left){
-			step_to_point += player_speed * glm::vec3(sinf(player_heading + M_PI/2), 0, cosf(player_heading + M_PI/2));
-		}
-		if(player_key_status.right){
-			step_to_point += player_speed * glm::vec3(-sinf(player_heading + M_PI/2), 0, -cosf(player_heading + M_PI/2));
-		}
-                for(gameobject* o : objects) {
-                        long collide_index = o->collision_index(step_to_point, 0.2f);
-                        if(collide_index != -1) {
-                                if(is_empty(glm::vec3(player_position.x, step_to_point.y, step_to_point.z), 0.2f)) {
-                                        step_to_point.x = player_position.x;
-                                        break;
-                                }
-                                else if(is_empty(glm::vec3(step_to_point.x, step_to_point.y, player_position.z), 0.2f)) {
-                                        step_to_point.z = player_position.z;
-                                        break;
-                                }
-                                else {
-                                        step_to_point = player_position;
-                                        break;
-                                }
-
-
-                        }
-                }
-                player_position = step_to_point;
-
-		if(player_platform){
-			if(!player_platform->is_on_idx(player_position, player_platform_index))
-				player_platform = 0;
-		} else {
-			float floor_height = 0;
-			for(gameobject* o : objects) {
-				long ppi = o->is_on(player_position);
-				if(ppi != -1) {
-					player_platform_index = ppi;
-					player_platform = o;	
-					floor_height = player_platform->locations[player_platform_index].y + (player_platform->size.y / 2);
-					player_fall_speed = 0;
-					player_position.y = floor_height + player_height; 
-				}
-			}
-			if(player_position.y - player_height > floor_height) {
-				player_position.y += player_fall_speed;
-				player_fall_speed -= GRAVITY;
-			} else {
-				player_fall_speed = 0;
-				player_position.y = floor_height + player_height; 
-			}
-		}
-//		grand_mutex.unlock();
-		auto end = std::chrono::system_clock::now();
-		//		double difference = std::chrono::duration_cast<std::chrono::milliseconds>(start - end).count();
-		//		printf("Time difference:  %lf\n", difference);
-		std::this_thread::sleep_for(std::chrono::microseconds(1000) - (start - end));
-	}
-}
-
-void object_movement(){
-	while(!shutdown_engine){
-		auto start = std::chrono::system_clock::now();
-//		grand_mutex.lock();
-		if(player_platform){
-			glm::vec3 pltloc = player_platform->locations[player_platform_index];
-			float floor_height = pltloc.y + (player_platform->size.y / 2);
-			player_position.y = floor_height + player_height;
-		}
-//		grand_mutex.unlock();
-		for(gameobject* o : objects)
-			o->move();
-		auto end = std::chrono::system_clock::now();
-		//		double difference = std::chrono::duration_cast<std::chrono::milliseconds>(start - end).count();
-		//		printf("Time difference:  %lf\n", difference);
-		std::this_thread::sleep_for(std::chrono::microseconds(1000) - (start - end));
-	}
-}
-
-void animation(){
-	while(!shutdown_engine){
-		auto start = std::chrono::system_clock::now();
-		for(gameobject* o : objects)
-			o->animate();
-		auto end = std::chrono::system_clock::now();
-		//		double difference = std::chrono::duration_cast<std::chrono::milliseconds>(start - end).count();
-		//		printf("Time difference:  %lf\n", difference);
-		std::this_thread::sleep_for(std::chrono::microseconds(10000) - (start - end));
-	}
-}
-
-void collision_detection(){
-	while(!shutdown_engine){
-		auto start = std::chrono::system_clock::now();
-		ice_balls.data_mutex.lock();
-		for(size_t proj_index = 0; proj_index < ice_balls.locations.size(); proj_index++){
-			glm::vec3 l = ice_balls.locations[proj_index];
-			for(auto o : objects){
-				if(o->collision_check){
-					long index = o->collision_index(l);
-					if(index != -1) {
-						o->hit_index(index);
-						ice_balls.hit_index(proj_index);
-						break;
-					}
-				}
-			}
-		}	
-		ice_balls.data_mutex.unlock();
-		auto end = std::chrono::system_clock::now();
-		//		double difference = std::chrono::duration_cast<std::chrono::milliseconds>(start - end).count();
-		//		printf("Time difference:  %lf\n", difference);
-		std::this_thread::sleep_for(std::chrono::microseconds(1000) - (start - end));
-	}
-}
 void pos_callback(GLFWwindow* window, double xpos, double ypos){
 	double center_x = width/2;
 	double diff_x = xpos - center_x;
@@ -308,29 +188,166 @@ void bob(){
 	static bool bob_happened = false;
 	if(!bob_happened){
 		bob_happened = true;
-		targets.locations.push_back(glm::vec3(-10, 5, 10));
+		targets.add_location(glm::vec3(-10, 5, 10));
 		//could activate turret or do something else instead of this.
 	}
 };
 
+/* Render frame times, start to start, so it includes waiting on the swap */
+hdr_histogram frame_times;
+
+/* Percentiles of frame, tick and phase times and tick overruns, as CSV */
+void write_latency_summary(const char* filename) {
+	FILE* f = fopen(filename, "w");
+	if(!f) {
+		printf("Couldn't write %s\n", filename);
+		return;
+	}
+	hdr_histogram::csv_header(f);
+	if(frame_times.count())
+		frame_times.csv_row(f, "frame");
+	if(sim_scheduler.tick_count)
+		sim_scheduler.write_csv(f);
+	fclose(f);
+	printf("Wrote latency summary to %s\n", filename);
+}
+
+/* What the last frame drew of each object */
+void print_cull_stats() {
+	for(renderable* r : renderers) {
+		const cull_stats& c = r->cull;
+		if(c.total)
+			printf("  %-40s %6zu / %6zu visible, LODs %zu/%zu/%zu/%zu, %zu triangles\n", r->label(), c.visible, c.total,
+				c.lod_instances[0], c.lod_instances[1], c.lod_instances[2], c.lod_instances[3], c.triangles);
+	}
+}
+
+/* Where the camera is on frame of frames in headless mode:  one lap around the level,
+ * looking in at the middle from outside the targets and turret
+ */
+void camera_path(int frame, int frames, glm::vec3& eye, float& heading, float& elevation) {
+	const glm::vec3 centre(40, 0, 0);
+	float angle = 2 * M_PI * frame / frames;
+	eye = centre + glm::vec3(180 * sinf(angle), 25, 180 * cosf(angle));
+	glm::vec3 to_centre = centre - eye;
+	heading = atan2f(to_centre.x, to_centre.z);
+	elevation = -0.1f;
+}
+
+/* Clears and draws everything from eye, returning the CPU time the draws took in ms */
+double draw_frame(batch_renderer& batches, glm::vec3 eye, float heading, float elevation) {
+	glClearColor(0, 0, 0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	/* Where are we?  A:  eye
+	 * What are we looking at?
+	 */
+	glm::vec3 look_at_point = eye;
+	look_at_point.x += cosf(elevation) * sinf(heading);
+	look_at_point.y += sinf(elevation);
+	look_at_point.z += cosf(elevation) * cosf(heading);
+	glm::mat4 view = glm::lookAt(eye, look_at_point, glm::vec3(0, 1, 0));
+	glm::mat4 projection = glm::perspective(45.0f, width / height, 0.1f, 10000.0f);
+	glm::mat4 vp = projection * view;
+
+	auto draw_start = std::chrono::steady_clock::now();
+	for(renderable* r : renderers) {
+		PROFILE_SCOPE(r->label());
+		r->draw(vp);
+	}
+	PROFILE_SCOPE("batches");
+	draw_calls += batches.draw(vp, height);
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - draw_start).count();
+}
+
+/* Renders frames along camera_path with the simulation stopped, so every run draws the same
+ * thing, and prints frame time statistics.  glFinish at the end of each frame stands in for
+ * the swap, so frame times include the GPU's work.
+ */
+void run_headless(batch_renderer& batches, int frames) {
+	std::vector<double> frame_ms, draw_ms;
+	frame_ms.reserve(frames);
+	draw_ms.reserve(frames);
+	glFinish();
+	auto start = std::chrono::steady_clock::now();
+	for(int f = 0; f < frames; f++) {
+		framecount++;
+		PROFILE_SCOPE("frame");
+		auto frame_start = std::chrono::steady_clock::now();
+		glm::vec3 eye;
+		float heading, elevation;
+		camera_path(f, frames, eye, heading, elevation);
+		draw_ms.push_back(draw_frame(batches, eye, heading, elevation));
+		glFinish();
+		frame_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count());
+		frame_times.record(std::chrono::steady_clock::now() - frame_start);
+	}
+	double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("Headless:  %d frames at %.0fx%.0f in %.1f ms, %.1f frames/s, %d draw calls\n", frames, width, height, total, 1000.0 * frames / total, draw_calls);
+	print_frame_stats("frame", frame_ms);
+	print_frame_stats("draw (CPU)", draw_ms);
+	print_cull_stats();
+}
+
 int main(int argc, char** argv) {
 	srand((unsigned int)time(0));
 
+	/* --bc1:  BC1 compress textures, a quarter the size of RGB8 with some loss of quality
+	 * --headless N:  no window, render N frames offscreen along a fixed path and report frame times
+	 * --stats N:  print frame and tick time percentiles every N seconds
+	 */
+	bool bc1 = false;
+	int headless_frames = 0;
+	double stats_seconds = 0;
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--bc1"))
+			bc1 = true;
+		else if(!strcmp(argv[i], "--headless") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+			headless_frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--stats") && i + 1 < argc && atof(argv[i + 1]) > 0)
+			stats_seconds = atof(argv[++i]);
+		else
+			printf("Unknown argument:  %s\n", argv[i]);
+	}
+
+	PROFILE_THREAD("render");
 	general_buffer = (char*)malloc(GBLEN);
-	glfwInit();
-	GLFWwindow* window = glfwCreateWindow(width, height, "Simple OpenGL 4.0+ Demo", 0, 0);
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-	glfwMakeContextCurrent(window);
-	glewInit();
+	GLFWwindow* window = 0;
+	headless_context headless;
+	if(headless_frames) {
+		if(headless.init())
+			return 1;
+	} else {
+		glfwInit();
+		window = glfwCreateWindow(width, height, "Simple OpenGL 4.0+ Demo", 0, 0);
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		glfwMakeContextCurrent(window);
+	}
+	GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	if(glew_status == GLEW_ERROR_NO_GLX_DISPLAY)	// GLX only, and GL itself loaded fine
+		glew_status = GLEW_OK;
+#endif
+	if(glew_status != GLEW_OK) {
+		printf("glewInit failed:  %s\n", (const char*)glewGetErrorString(glew_status));
+		return 1;
+	}
+	if(headless_frames && headless.make_framebuffer(width, height))
+		return 1;
+	assets.compress_textures = bc1 && GLEW_EXT_texture_compression_s3tc;
 
 	unsigned supported_threads = std::thread::hardware_concurrency();
 	printf("Supported threads:  %u\n", supported_threads);
+	jobs.start(supported_threads);
 
 	/* Set up callbacks */
-	glfwSetKeyCallback(window, key_callback);
-	glfwSetCursorPosCallback(window, pos_callback);
-	glfwSetFramebufferSizeCallback(window, resize);
-	glfwSetMouseButtonCallback(window, mouse_click_callback);
+	if(window) {
+		glfwSetKeyCallback(window, key_callback);
+		glfwSetCursorPosCallback(window, pos_callback);
+		glfwSetFramebufferSizeCallback(window, resize);
+		glfwSetMouseButtonCallback(window, mouse_click_callback);
+	}
 
 	/* Set starting point */
 	player_position = glm::vec3(53, 10, 50);
@@ -338,76 +355,124 @@ int main(int argc, char** argv) {
 
 
 	/* Level Loading (hardcoded at the moment) */
-	tile_floor fl;
-	objects.push_back(&ice_balls);
-	objects.push_back(&fl);
+	add_object(&ice_balls);
+	renderers.push_back(new tile_floor);
 
 	//already called targets above bob()
 	targets.scale = 1.0f;
 	for (int i = -100; i < 200; i += 20) {
-		targets.locations.push_back(glm::vec3(i, 0, -100));
+		targets.add_location(glm::vec3(i, 0, -100));
 	}
-	objects.push_back(&targets);
+	add_object(&targets);
 
-	//objects.push_back(&brick_fragments);
+	//add_object(&brick_fragments);
 
 	/*texture cube*/
 	loaded_object tex_cube("tex_cube.obj", "beans.jpg", glm::vec3(10, 10, 10));
-	tex_cube.locations.push_back(glm::vec3(0, 0, -100));
-	objects.push_back(&tex_cube);
+	tex_cube.add_location(glm::vec3(0, 0, -100));
+	add_object(&tex_cube);
 
 	turret t;
-	t.locations.push_back(glm::vec3(100, 30, 100));
+	t.add_location(glm::vec3(100, 30, 100));
 	t.player_target = &player_position;
 	t.current_projectile = &ice_balls;
-	objects.push_back(&t);
+	add_object(&t);
 
 
-	/* Initialize game objects */
-	for(gameobject* o : objects){
-		if(o->init()){
+	/* Load files on the workers, then initialize game objects, which uploads them */
+	for(renderable* r : renderers)
+		r->request_assets();
+	{
+		PROFILE_SCOPE("load_requested");
+		assets.load_requested(jobs);
+	}
+	for(renderable* r : renderers){
+		PROFILE_SCOPE(r->label());
+		if(r->init()){
 			puts(RED("Compile Failed, giving up!").c_str());
 			return 1;
 		}
 	}
 
-	/* Start Other Threads */
-	std::thread player_movement_thread(player_movement);
-	std::thread object_movement_thread(object_movement);
-	std::thread animation_thread(animation);
-	std::thread collision_detection_thread(collision_detection);
+	/* Loaded objects share shaders, so draw whatever we can with one multi-draw per instance format */
+	batch_renderer batches;
+	if(batches.init(assets)) {
+		puts("Batch renderer unavailable, drawing objects one by one");
+	} else {
+		for(renderable* r : renderers)
+			r->add_to_batch(batches);
+		batches.build();
+	}
 
+	publish();
 	glEnable(GL_DEPTH_TEST);
+
+	if(headless_frames) {
+		run_headless(batches, headless_frames);
+		jobs.stop();
+		PROFILE_WRITE_TRACE("trace.json");
+		write_latency_summary("latency.csv");
+		batches.destroy();
+		for(renderable* r : renderers) {
+			r->deinit();
+			delete r;
+		}
+		headless.destroy();
+		free(general_buffer);
+		return 0;
+	}
+
+	/* Start Other Threads */
+	sim_scheduler.report_seconds = stats_seconds;
+	std::thread simulation_thread(simulation);
+
+	/* CPU side cost of issuing the draws, averaged over DRAW_REPORT_FRAMES */
+	const int DRAW_REPORT_FRAMES = 500;
+	double draw_time_total = 0;
+
+	auto last_frame = std::chrono::steady_clock::now();
+	auto next_report = last_frame + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(stats_seconds));
 	while (!glfwWindowShouldClose(window)) {
 		framecount++;
+		PROFILE_SCOPE("frame");
+		auto frame_start = std::chrono::steady_clock::now();
+		frame_times.record(frame_start - last_frame);
+		last_frame = frame_start;
+		if(stats_seconds > 0 && frame_start >= next_report) {
+			puts("Render:");
+			frame_times.print("frame");
+			next_report = frame_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(stats_seconds));
+		}
 		glfwPollEvents();
-		glClearColor(0, 0, 0, 1.0);
-		glClear(GL_COLOR_BUFFER_BIT);
-		glClear(GL_DEPTH_BUFFER_BIT);
 
 //		grand_mutex.lock();
-
-		glm::vec3 axis_y(0, 1, 0);
-		/* Where are we?  A:  player_position
-		 * What are we looking at?
-		 */
-		glm::vec3 look_at_point = player_position;
-		look_at_point.x += cosf(player_elevation) * sinf(player_heading);
-		look_at_point.y += sinf(player_elevation);
-		look_at_point.z += cosf(player_elevation) * cosf(player_heading);
-		glm::mat4 view = glm::lookAt(player_position, look_at_point, glm::vec3(0, 1, 0));
-		glm::mat4 projection = glm::perspective(45.0f, width / height, 0.1f, 10000.0f);
-		glm::mat4 vp = projection * view;
-
-		for(gameobject* o : objects)
-			o->draw(vp);
+		draw_time_total += draw_frame(batches, camera_position.latest(), player_heading, player_elevation);
 //		grand_mutex.unlock();
+		if(framecount % DRAW_REPORT_FRAMES == 0) {
+			size_t instances = 0;
+			for(gameobject* o : objects)
+				instances += o->snapshots.current().count;
+			printf("Draw CPU time:  %.3f ms/frame over %d frames, %zu instances, %.2f us per draw call\n", draw_time_total / DRAW_REPORT_FRAMES, DRAW_REPORT_FRAMES, instances, draw_calls ? 1000.0 * draw_time_total / draw_calls : 0.0);
+			draw_time_total = 0;
+			draw_calls = 0;
+			print_cull_stats();
+		}
 
 		glfwSwapBuffers(window);
 	}
 	shutdown_engine = 1;
-	player_movement_thread.join();
-	// TODO:  join other threads
+	simulation_thread.join();
+	jobs.stop();
+	sim_scheduler.print_stats();
+	PROFILE_WRITE_TRACE("trace.json");
+	write_latency_summary("latency.csv");
+	batches.destroy();
+	for(renderable* r : renderers) {
+		r->deinit();
+		delete r;
+	}
+	if(assets.live())
+		printf("%zu assets still acquired at shutdown\n", assets.live());
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	free(general_buffer);
@@ -0,0 +1,315 @@
+#ifndef ASSET_REGISTRY_H
+#define ASSET_REGISTRY_H
+
+#include<GL/glew.h>
+#include<string>
+#include<unordered_map>
+#include<vector>
+#include<stdio.h>
+#include<stddef.h>
+#include<math.h>
+#include<chrono>
+#include<algorithm>
+#include "game.h"
+#include "job_system.h"
+
+GLuint make_program(const char* v_file, const char* tcs_file, const char* tes_file, const char* g_file, const char* f_file);
+
+/* Attribute locations, fixed with layout(location = ...) in the shaders so a mesh's VAO works
+ * with any program
+ */
+#define ATTRIB_POSITION 0
+#define ATTRIB_TEXCOORD 1
+
+/* Everything drawing a mesh needs, worked out once when it's uploaded.  The VAO holds the
+ * attribute layout and index buffer, so a draw binds it and goes, without asking GL anything.
+ */
+struct mesh_descriptor {
+	GLuint vao = 0, vbuf = 0, ebuf = 0;
+	size_t vertex_count = 0, index_count = 0;	// index_count covers every LOD
+	int lod_count = 1;
+	mesh_lod lods[MAX_LODS] = {};	// Ranges of the index buffer, full detail first
+	GLenum index_type = GL_UNSIGNED_INT;	// GL_UNSIGNED_SHORT whenever every index fits
+	GLsizei vertex_stride = sizeof(vertex);
+	size_t position_offset = offsetof(vertex, pos);
+	long texcoord_offset = offsetof(vertex, tex_coord);	// -1 for none
+	float radius = 0;	// Bounding sphere around the model's origin, for culling
+	size_t index_size() const { return index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t); }
+
+	/* Once vbuf, ebuf and the layout are filled in */
+	void make_vao() {
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbuf);
+		glEnableVertexAttribArray(ATTRIB_POSITION);
+		glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, vertex_stride, (const void*)position_offset);
+		if(texcoord_offset >= 0) {
+			glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+			glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, vertex_stride, (const void*)texcoord_offset);
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebuf);
+		glBindVertexArray(0);
+	}
+	void destroy() {
+		glDeleteVertexArrays(1, &vao);
+		glDeleteBuffers(1, &vbuf);
+		glDeleteBuffers(1, &ebuf);
+		vao = vbuf = ebuf = 0;
+	}
+};
+
+/* Shared, reference counted meshes, textures and programs.
+ * Several object types use the same model or texture (tex_cube.obj, beans.jpg, projectile.obj),
+ * so each is loaded and uploaded once, keyed by file name and load parameters.  Every acquire
+ * is matched by a release with the same arguments, normally in deinit, and the GL objects are
+ * deleted when the last user lets go.
+ * Loading can be staged:  request_* everything init() is going to acquire, then load_requested
+ * reads, parses and decodes it all on the job system.  acquire_* then only has to upload.
+ * Anything acquired without a request is loaded on the spot.
+ * Programs are keyed by what's in the shader files, not their names, and linked programs are
+ * saved with the program binary cache (see helpers.cpp), so a warm start doesn't compile at all.
+ * Apart from the worker side of load_requested, GL thread only.
+ */
+class asset_registry {
+	public:
+		/* Store textures BC1 compressed.  Only set it if GL has EXT_texture_compression_s3tc. */
+		bool compress_textures = false;
+
+		void request_mesh(const char* file, float scale, bool swap_yz) {
+			std::string key = mesh_key(file, scale, swap_yz);
+			if(meshes.count(key) || staged_meshes.count(key))
+				return;
+			staged_mesh& m = staged_meshes[key];
+			m.file = file;
+			m.scale = scale;
+			m.swap_yz = swap_yz;
+		}
+		void request_texture(const char* file) {
+			if(textures.count(file) || staged_textures.count(file))
+				return;
+			staged_textures[file].file = file;
+		}
+
+		/* Loads everything requested so far in parallel, then prints how long each took */
+		void load_requested(job_system& jobs) {
+			auto start = std::chrono::steady_clock::now();
+			job_group group;
+			for(auto& it : staged_meshes) {
+				staged_mesh* m = &it.second;
+				if(m->loaded)
+					continue;
+				jobs.run(group, [m, &jobs]() {
+					auto t = std::chrono::steady_clock::now();
+					load_model(m->vertices, m->indices, m->file.c_str(), m->scale, m->swap_yz, &jobs, &m->lods);
+					m->ms = ms_since(t);
+					m->loaded = true;
+				});
+			}
+			for(auto& it : staged_textures) {
+				staged_texture* tx = &it.second;
+				if(tx->loaded)
+					continue;
+				bool compress = compress_textures;
+				jobs.run(group, [tx, compress]() {
+					auto t = std::chrono::steady_clock::now();
+					decode_texture(tx->file.c_str(), tx->image, compress);
+					tx->ms = ms_since(t);
+					tx->loaded = true;
+				});
+			}
+			jobs.wait(group);
+			for(auto& it : staged_meshes)
+				printf("  mesh     %-40s %8.2f ms\n", it.second.file.c_str(), it.second.ms);
+			for(auto& it : staged_textures)
+				printf("  texture  %-40s %8.2f ms\n", it.second.file.c_str(), it.second.ms);
+			printf("Loaded %zu assets in %.2f ms on %u workers\n", staged_meshes.size() + staged_textures.size(), ms_since(start), jobs.worker_count());
+		}
+
+		mesh_descriptor acquire_mesh(const char* file, float scale, bool swap_yz) {
+			std::string key = mesh_key(file, scale, swap_yz);
+			entry<mesh_descriptor>& e = meshes[key];
+			if(e.refs++) {
+				printf("Sharing mesh %s (%d users)\n", file, e.refs);
+				return e.value;
+			}
+			std::vector<vertex> vertices;
+			std::vector<uint32_t> indices;
+			std::vector<mesh_lod> lods;
+			auto staged = staged_meshes.find(key);
+			if(staged != staged_meshes.end() && staged->second.loaded) {
+				vertices.swap(staged->second.vertices);
+				indices.swap(staged->second.indices);
+				lods.swap(staged->second.lods);
+				staged_meshes.erase(staged);
+			} else {
+				load_model(vertices, indices, file, scale, swap_yz, 0, &lods);
+			}
+			if(lods.empty())
+				lods.push_back(mesh_lod{0, (uint32_t)indices.size(), 0.0f});
+
+			glBindVertexArray(0);	// Binding the index buffer below would otherwise change whatever VAO is bound
+			glGenBuffers(1, &e.value.vbuf);
+			glBindBuffer(GL_ARRAY_BUFFER, e.value.vbuf);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+			// Half the index memory and fetch bandwidth for anything under 64k vertices, which is most models
+			glGenBuffers(1, &e.value.ebuf);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, e.value.ebuf);
+			if(vertices.size() <= 0x10000) {
+				std::vector<uint16_t> short_indices(indices.begin(), indices.end());
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * short_indices.size(), short_indices.data(), GL_STATIC_DRAW);
+				e.value.index_type = GL_UNSIGNED_SHORT;
+			} else {
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * indices.size(), indices.data(), GL_STATIC_DRAW);
+				e.value.index_type = GL_UNSIGNED_INT;
+			}
+
+			e.value.vertex_count = vertices.size();
+			e.value.index_count = indices.size();
+			e.value.lod_count = lods.size();
+			std::copy(lods.begin(), lods.end(), e.value.lods);
+			for(const vertex& v : vertices)
+				e.value.radius = fmaxf(e.value.radius, glm::length(v.pos));
+			e.value.make_vao();
+			return e.value;
+		}
+		void release_mesh(const char* file, float scale, bool swap_yz) {
+			release(meshes, mesh_key(file, scale, swap_yz), [](mesh_descriptor& m) { m.destroy(); });
+		}
+
+		GLuint acquire_texture(const char* file) {
+			entry<GLuint>& e = textures[file];
+			if(e.refs++) {
+				printf("Sharing texture %s (%d users)\n", file, e.refs);
+				return e.value;
+			}
+			auto staged = staged_textures.find(file);
+			if(staged != staged_textures.end() && staged->second.loaded) {
+				if(staged->second.image.levels.size())
+					e.value = upload_texture(staged->second.image);
+				staged_textures.erase(staged);
+			} else {
+				e.value = load_texture(file, compress_textures);
+			}
+			return e.value;
+		}
+		void release_texture(const char* file) {
+			release(textures, file, [](GLuint& tex) { glDeleteTextures(1, &tex); });
+		}
+
+		/* Same arguments as make_program.  Returns 0 if it didn't build, and that isn't kept. */
+		GLuint acquire_program(const char* v_file, const char* tcs_file, const char* tes_file, const char* g_file, const char* f_file) {
+			const char* files[] = {v_file, tcs_file, tes_file, g_file, f_file};
+			uint64_t source_hash;
+			if(!hash_files(files, 5, source_hash))
+				return 0;
+			std::string names = program_key(v_file, tcs_file, tes_file, g_file, f_file);
+			std::string key = program_source_key(source_hash);
+			program_keys[names] = key;
+			entry<GLuint>& e = programs[key];
+			if(e.refs++)
+				return e.value;
+
+			std::string cache_path = program_cache_path(v_file, names);
+			e.value = load_program_binary(cache_path.c_str(), source_hash);
+			if(!e.value) {
+				e.value = make_program(v_file, tcs_file, tes_file, g_file, f_file);
+				if(e.value)
+					save_program_binary(e.value, cache_path.c_str(), source_hash);
+			}
+			if(!e.value)
+				programs.erase(key);
+			return e.value;
+		}
+		void release_program(const char* v_file, const char* tcs_file, const char* tes_file, const char* g_file, const char* f_file) {
+			auto key = program_keys.find(program_key(v_file, tcs_file, tes_file, g_file, f_file));
+			if(key == program_keys.end()) {
+				printf("Released program %s, which wasn't acquired\n", v_file);
+				return;
+			}
+			release(programs, key->second, [](GLuint& p) { glDeleteProgram(p); });
+		}
+
+		/* Anything still acquired, for checking at shutdown that every acquire was released */
+		size_t live() const { return meshes.size() + textures.size() + programs.size(); }
+
+	private:
+		template<typename T>
+		struct entry {
+			T value = {};
+			int refs = 0;
+		};
+		std::unordered_map<std::string, entry<mesh_descriptor>> meshes;
+		std::unordered_map<std::string, entry<GLuint>> textures;
+		std::unordered_map<std::string, entry<GLuint>> programs;	// By source hash
+		std::unordered_map<std::string, std::string> program_keys;	// File names to source hash, for release
+
+		/* Requested, and once loaded is set, ready to upload */
+		struct staged_mesh {
+			std::string file;
+			float scale = 1.0f;
+			bool swap_yz = false;
+			std::vector<vertex> vertices;
+			std::vector<uint32_t> indices;
+			std::vector<mesh_lod> lods;
+			double ms = 0;
+			bool loaded = false;
+		};
+		struct staged_texture {
+			std::string file;
+			image_data image;
+			double ms = 0;
+			bool loaded = false;
+		};
+		std::unordered_map<std::string, staged_mesh> staged_meshes;
+		std::unordered_map<std::string, staged_texture> staged_textures;
+
+		static double ms_since(std::chrono::steady_clock::time_point t) {
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+		}
+
+		template<typename T, typename F>
+		void release(std::unordered_map<std::string, entry<T>>& table, const std::string& key, F destroy) {
+			auto it = table.find(key);
+			if(it == table.end()) {
+				printf("Released %s, which wasn't acquired\n", key.c_str());
+				return;
+			}
+			if(--it->second.refs)
+				return;
+			destroy(it->second.value);
+			table.erase(it);
+		}
+
+		static std::string mesh_key(const char* file, float scale, bool swap_yz) {
+			char params[48];
+			snprintf(params, sizeof(params), "|%a|%d", scale, swap_yz ? 1 : 0);
+			return std::string(file) + params;
+		}
+		static std::string program_source_key(uint64_t source_hash) {
+			char key[24];
+			snprintf(key, sizeof(key), "%016llx", (unsigned long long)source_hash);
+			return key;
+		}
+		/* Next to the vertex shader, one per combination of files, so editing a shader
+		 * replaces its cache instead of adding another
+		 */
+		static std::string program_cache_path(const char* v_file, const std::string& names) {
+			uint32_t h = 2166136261u;
+			for(char c : names)
+				h = (h ^ (unsigned char)c) * 16777619u;
+			char suffix[32];
+			snprintf(suffix, sizeof(suffix), ".%08x.programcache", h);
+			return std::string(v_file) + suffix;
+		}
+		static std::string program_key(const char* v_file, const char* tcs_file, const char* tes_file, const char* g_file, const char* f_file) {
+			std::string key;
+			for(const char* f : {v_file, tcs_file, tes_file, g_file, f_file}) {
+				key += f ? f : "";
+				key += '|';
+			}
+			return key;
+		}
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include<stdio.h>
 #include<iostream>
 #include<stdlib.h>
+#include<string.h>
 #include<fcntl.h>
 #include<GL/glew.h>
 #include<GLFW/glfw3.h>
@@ -18,12 +19,14 @@
 
 #include "scolor.hpp"
 #include "game.h"
+#include "sim.h"
+#include "instance_ring.h"
+#include "asset_registry.h"
+#include "batch_renderer.h"
 
-#define _USE_MATH_DEFINES
-#define GRAVITY 0.015f
-#define M_PI 3.14159265f	
-
-class gameobject;
+/* The renderer.  Simulation objects are in sim.h and know nothing about GL;  everything here
+ * only reads them through their snapshots.
+ */
 
 float height = 1550;
 float width = 2600;
@@ -35,77 +38,49 @@ float width = 2600;
 /* Global section */
 char* general_buffer;
 int framecount = 0;
-int time_resolution = 10;
 
-/* Player globals */
-glm::vec3 player_position;
-float player_heading;
-float player_height = 2;
-float player_elevation;
-float player_fall_speed = 0;
-float player_speed = .6f;
-bool player_dead = false;
-gameobject* player_platform = 0;
-size_t player_platform_index = 0;
+/* Shared meshes, textures and shader programs */
+asset_registry assets;
 
-std::vector<gameobject*> objects;
+/* glDraw* calls issued by the render thread, for the draw cost report */
+int draw_calls = 0;
 
 
 
-GLuint make_program(const char* v_file, const char* tcs_file, const char* tes_file, const char* g_file, const char* f_file);
 GLuint make_shader(const char* filename, GLenum shaderType);
 
-class gameobject {
+/* Something drawn each frame, render thread only */
+class renderable {
 	public:
-		bool collision_check = false;
-		std::vector<glm::vec3> locations;
-		glm::vec3 size; // What about non-square objects?
+		/* Frustum culling results from the last frame drawn, for the report */
+		cull_stats cull;
+		virtual ~renderable() {}
+		virtual const char* label() { return "object"; }
+		/* Ask assets for whatever init() will acquire, so it can be loaded ahead in parallel */
+		virtual void request_assets() {}
 		virtual int init() { return 0; }
 		virtual void deinit() {};
 		virtual void draw(glm::mat4) {}
-		virtual void move() {}
-		virtual void animate() {}
-		virtual bool is_on_idx(glm::vec3 position, size_t index) {return false;}
-		virtual long is_on(glm::vec3 position) {return -1;}
-		virtual long collision_index(glm::vec3 position, float distance = 0) {
-			return -1;
-		}
-		virtual glm::vec3 collision_normal(glm::vec3 move_to, glm::vec3 old_position, long index, float distance = 0) {
-			return glm::vec3(0, 0, 0);
-		}
-		virtual bool collision_with_index(glm::vec3 position, size_t index, float distance = 0) { return false; }//GO BACK TO THIS
-		virtual void hit_index(long index) {}
-};
-
-class activation_area : public gameobject {
-	public:
-		std::vector<void (*)()> callbacks;
-		activation_area() {
-			collision_check = false;
-		}
-		void add_area(glm::vec3 location, void (*callback_function)()){
-			locations.push_back(location);
-			callbacks.push_back(callback_function);
-		}
-		long collision_index(glm::vec3 position, float distance = 0){
-			for(long i = 0; i < locations.size(); i++){
-				glm::vec3 l = locations[i]; // This'll get optimized out
-				// TODO:  Collision Bounds
-				if(	size.x/2.0f + distance > abs(l.x-position.x) && 
-						size.y/2.0f + distance > abs(l.y-position.y) && 
-						size.z/2.0f + distance > abs(l.z-position.z)){
-					callbacks[i]();
-					return i;
-				}
-			}
-			return -1;
-		}
+		/* Hand drawing over to batches if it'll take it.  Returns whether it did. */
+		virtual bool add_to_batch(batch_renderer& batches) { return false; }
 };
 
+/* 100 by 100 tiles, 10 wide, centred on the origin.  Tiles are culled against the frustum each
+ * frame and the shader places each instance from its tile number.
+ */
+#define FLOOR_TILES 10000
 
-class tile_floor : public gameobject {
+class tile_floor : public renderable {
 	public:
-		unsigned int mvp_uniform, anim_uniform, v_attrib, c_attrib, program, vbuf, cbuf, ebuf, tex;
+		unsigned int mvp_uniform, anim_uniform, program, tex;
+		mesh_descriptor mesh;
+		instance_ring tiles_ring;
+		std::vector<glm::vec4> tile_centres;	// Scale 1 in w, the layout cull_spheres wants
+		std::vector<uint32_t> visible;
+		const char* label() override { return "floor"; }
+		void request_assets() override {
+			assets.request_texture("stone_floor.jpg");
+		}
 		int init() override {
 			// Initialization part
 			float vertices[] = {
@@ -114,483 +89,172 @@ class tile_floor : public gameobject {
 				-1.0, -10,  -1.0,
 				-1.0, -10,  1.0,
 			};
-			glGenBuffers(1, &vbuf);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbuf);
-			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+			glGenBuffers(1, &mesh.vbuf);
+			glBindBuffer(GL_ARRAY_BUFFER, mesh.vbuf);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
 			GLushort floor_elements[] = {
 				0, 1, 2, 2, 3, 0,
 
 			};
-			glGenBuffers(1, &ebuf);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebuf);
+			glGenBuffers(1, &mesh.ebuf);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebuf);
 			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(floor_elements), floor_elements, GL_STATIC_DRAW);
 
-			tex = load_texture("stone_floor.jpg");
-
-			program = make_program("floor_vertex_shader.glsl",0, 0, 0, "floor_fragment_shader.glsl");
+			// Positions only, the shader makes texture coordinates from them
+			mesh.vertex_count = 4;
+			mesh.index_count = 6;
+			mesh.lods[0] = mesh_lod{0, 6, 0.0f};
+			mesh.index_type = GL_UNSIGNED_SHORT;
+			mesh.vertex_stride = 3 * sizeof(float);
+			mesh.position_offset = 0;
+			mesh.texcoord_offset = -1;
+			mesh.radius = 5.0f * sqrtf(2.0f);
+			mesh.make_vao();
+
+			// Matches floor_vertex_shader.glsl
+			tile_centres.resize(FLOOR_TILES);
+			for(int i = 0; i < FLOOR_TILES; i++)
+				tile_centres[i] = glm::vec4((2 * (i / 100) - 100) * 5.0f, -10.0f, (2 * (i % 100) - 100) * 5.0f, 1.0f);
+			visible.resize(FLOOR_TILES);
+
+			tex = assets.acquire_texture("stone_floor.jpg");
+
+			program = assets.acquire_program("floor_vertex_shader.glsl",0, 0, 0, "floor_fragment_shader.glsl");
 			if (!program)
 				return 1;
 
-			v_attrib = glGetAttribLocation(program, "in_vertex");
-			//c_attrib = glGetAttribLocation(program, "in_color");
 			mvp_uniform = glGetUniformLocation(program, "mvp");
 			return 0;
 		}
+		void deinit() override {
+			mesh.destroy();
+			tiles_ring.destroy();
+			assets.release_texture("stone_floor.jpg");
+			if(program)
+				assets.release_program("floor_vertex_shader.glsl",0, 0, 0, "floor_fragment_shader.glsl");
+		}
 		void draw(glm::mat4 vp) override {
-			glUseProgram(program);
+			glm::vec4 planes[6];
+			frustum_planes(vp, planes);
+			cull.total = FLOOR_TILES;
+			cull.visible = cull_spheres(tile_centres.data(), FLOOR_TILES, sizeof(glm::vec4), mesh.radius, planes, visible.data());
+			cull.lod_instances[0] = cull.visible;
+			cull.triangles = 2 * cull.visible;
+			if(!cull.visible)
+				return;
+			uint32_t* tiles = (uint32_t*)tiles_ring.begin(cull.visible * sizeof(uint32_t));
+			if(!tiles)
+				return;
+			memcpy(tiles, visible.data(), cull.visible * sizeof(uint32_t));
 
-			glEnableVertexAttribArray(v_attrib);
-			glBindBuffer(GL_ARRAY_BUFFER, vbuf);
-			glVertexAttribPointer(v_attrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+			glUseProgram(program);
+			tiles_ring.bind(0);
+			glBindVertexArray(mesh.vao);
 
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, tex);
 
-			int size;
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebuf);
-			glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-
 			glUniformMatrix4fv(mvp_uniform, 1, 0, glm::value_ptr(vp));
 
-			glDrawElementsInstanced(GL_TRIANGLES, size / sizeof(uint16_t), GL_UNSIGNED_SHORT, 0, 10000);
+			glDrawElementsInstanced(GL_TRIANGLES, mesh.index_count, mesh.index_type, 0, cull.visible);
+			draw_calls++;
+			tiles_ring.finish();
 		}
 };
 
-
-class loaded_object : public gameobject {
+/* Draws a loaded_object's snapshots with its model and texture */
+class object_renderer : public renderable {
 	public:
-		unsigned int mvp_uniform, anim_uniform, v_attrib, t_attrib, program, vbuf, cbuf, ebuf, tex, models_buffer;
-		const char *objectfile, *texturefile;
-		float scale = 1.0f;
-		bool swap_yz = false;
-		loaded_object(const char* of, const char* tf, glm::vec3 s) : objectfile(of), texturefile(tf) {
-			size = s;
-			collision_check = true;
+		loaded_object& object;
+		unsigned int mvp_uniform, anim_uniform, program, tex;
+		mesh_descriptor mesh;	// Shared through assets, don't destroy it here
+		instance_ring models_ring;
+		bool batched = false;	// Drawn by a batch_renderer, not draw()
+		cull_scratch scratch;
+		object_renderer(loaded_object& o) : object(o) {}
+
+		void request_assets() override {
+			assets.request_mesh(object.objectfile, object.scale, object.swap_yz);
+			assets.request_texture(object.texturefile);
 		}
-
 		int init() override {
-			// Initialization part
-			std::vector<vertex> vertices;
-			std::vector<uint32_t> indices; // Consider unified terminology
-
-			load_model(vertices, indices, objectfile, scale, swap_yz);
-
-			glGenBuffers(1, &vbuf);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, vbuf);
-			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+			// Shared with any other object using the same model, texture or shaders
+			mesh = assets.acquire_mesh(object.objectfile, object.scale, object.swap_yz);
 			// TODO:  Remember to explain the layout later
 
-			glGenBuffers(1, &ebuf);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebuf);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * indices.size(), indices.data(), GL_STATIC_DRAW);
-
-			glGenBuffers(1, &models_buffer);
-
-			tex = load_texture(texturefile);
+			tex = assets.acquire_texture(object.texturefile);
 
-			program = make_program("loaded_object_vertex_shader.glsl",0, 0, 0, "loaded_object_fragment_shader.glsl");
+			program = assets.acquire_program(vertex_shader_file(),0, 0, 0, "loaded_object_fragment_shader.glsl");
 			if (!program)
 				return 1;
 
-			v_attrib = glGetAttribLocation(program, "in_vertex");
-			t_attrib = glGetAttribLocation(program, "in_texcoord");
 			mvp_uniform = glGetUniformLocation(program, "vp");
 			return 0;
 		}
-
-		void draw(glm::mat4 vp) override {
-			glUseProgram(program);
-			std::vector<glm::mat4> models;
-			models.reserve(locations.size());
-			for(glm::vec3 l : locations){
-				glm::mat4 new_model = glm::mat4(1.0f);
-				new_model = translate(new_model, l);
-				models.push_back(new_model);
-			}
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, models_buffer);
-			glBufferData(GL_SHADER_STORAGE_BUFFER, models.size() * sizeof(glm::mat4), models.data(), GL_STATIC_DRAW);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, models_buffer);
-
-			glEnableVertexAttribArray(v_attrib);
-			glBindBuffer(GL_ARRAY_BUFFER, vbuf);
-			glVertexAttribPointer(v_attrib, 3, GL_FLOAT, GL_FALSE, 20, 0);
-
-			glEnableVertexAttribArray(t_attrib);
-			glVertexAttribPointer(t_attrib, 2, GL_FLOAT, GL_FALSE, 20, (const void*)12);
-
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, tex);
-
-			int size;
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebuf);
-			glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-
-			glUniformMatrix4fv(mvp_uniform, 1, 0, glm::value_ptr(vp));
-
-			glDrawElementsInstanced(GL_TRIANGLES, size / sizeof(GLuint), GL_UNSIGNED_INT, 0, locations.size());
+		void deinit() override {
+			models_ring.destroy();
+			assets.release_mesh(object.objectfile, object.scale, object.swap_yz);
+			assets.release_texture(object.texturefile);
+			if(program)
+				assets.release_program(vertex_shader_file(),0, 0, 0, "loaded_object_fragment_shader.glsl");
 		}
-		bool is_on_idx(glm::vec3 position, size_t index){
-			return (0.0f < (position.y - locations[index].y) && 
-					1.0f > (player_position.y - player_height) - (locations[index].y + size.y/2) &&
-					size.x/2 > fabs(position.x - locations[index].x) && 
-					size.z/2 > fabs(position.z - locations[index].z));
 
-		}
-		long is_on(glm::vec3 position) override {
-			for(long i = 0; i < locations.size(); i++)
-				if(is_on_idx(position, i))
-					return i;
-			return -1;
-		}
-		long collision_index(glm::vec3 position, float distance = 0){
-			for(long i = 0; i < locations.size(); i++){
-				glm::vec3 l = locations[i]; // This'll get optimized out
-				// TODO:  Collision Bounds
-				if(	size.x/2.0f + distance > abs(l.x-position.x) && 
-						size.y/2.0f + distance > abs(l.y-position.y) && 
-						size.z/2.0f + distance > abs(l.z-position.z)){
-					return i;	
-				}
-			}
-			return -1;
-		}
+		const char* label() override { return object.label(); }
 
-		/* Leaving y for later, so we finish today */
-		glm::vec3 collision_normal(glm::vec3 move_to, glm::vec3 old_position, long index, float distance = 0){
-			glm::vec3 l = locations[index]; // This'll get optimized out
-			if(	old_position.z > l.z + (size.z/2 + distance) &&
-					old_position.x >= l.x - (size.x/2 + distance) &&
-					old_position.x <= l.x + (size.x/2 + distance)){
-				return glm::vec3(0, 0, 1);
-			}
-			if(	old_position.z < l.z - (size.z/2 + distance) &&
-					old_position.x >= l.x - (size.x/2 + distance) &&
-					old_position.x <= l.x + (size.x/2 + distance)){
-				return glm::vec3(0, 0, -1);
-			}
-			if(	old_position.x < l.x - (size.x/2 + distance) &&
-					old_position.z >= l.z - (size.z/2 + distance) &&
-					old_position.z <= l.z + (size.z/2 + distance)){
-				return glm::vec3(1, 0, 0);
+		const char* vertex_shader_file() {
+			switch(object.format) {
+				case INSTANCE_VEC4:	return "loaded_object_vec4_vertex_shader.glsl";
+				case INSTANCE_QUAT:	return "loaded_object_quat_vertex_shader.glsl";
+				default:		return "loaded_object_vertex_shader.glsl";
 			}
-			if(	old_position.x > l.x + (size.x/2 + distance) &&
-					old_position.z >= l.z - (size.z/2 + distance) &&
-					old_position.z <= l.z + (size.z/2 + distance)){
-				return glm::vec3(-1, 0, 0);
-			}
-			puts("Ended collision normal without returning");
 		}
 
-		bool collision_with_index(glm::vec3 position, size_t index, float distance = 0){
-                        glm::vec3 l = locations[index]; // This'll get optimized out
-                        if(     size.x/2.0f + distance > abs(l.x-position.x) &&
-                                size.y/2.0f + distance > abs(l.y-position.y) &&
-                                size.z/2.0f + distance > abs(l.z-position.z)){
-                                return true;
-                        }
-                        return false;
-
-                }
-
-};
-
-float randvel(float speed) {
-	long min = -100;
-	long max = 100;
-	return speed * (min + rand() % (max + 1 - min));
-}
-/* Projectiles have:
- * 	speed
- * 	direction
- * 	lifespan
- */
-class projectile : public loaded_object {
-public:
-	std::vector<glm::vec3> directions;
-	std::vector<float> lifetimes;
-	std::vector<bool> bursting;
-	std::mutex data_mutex;
-	bool shot_no_hit = false;
-	projectile() : loaded_object("projectile.obj", "projectile.jpg", glm::vec3(0.1, 0.1, 0.1)) {
-		collision_check = false;//check back here ?
-	}
-	void dont_hit_self() {
-		shot_no_hit = true;
-	}
-	bool is_on_idx(glm::vec3 position, size_t index) override { return false; }
-	long is_on(glm::vec3 position) override { return -1; }
-	void create_burst(float quantity, glm::vec3 origin, float speed){
-		for(size_t i = 0; i < quantity; i++){
-			locations.push_back(origin);
-			lifetimes.push_back(10000.0f);
-			// One note:  This does create a cube of projectiles
-			directions.push_back(glm::vec3(randvel(speed), randvel(speed), randvel(speed)));
-			bursting.push_back(false);
+		bool add_to_batch(batch_renderer& batches) override {
+			batched = batches.add(mesh, tex, object.format, &object.snapshots, &cull);
+			return batched;
 		}
-	}
-	void move() {
-		data_mutex.lock();
-		for(int i = 0; i < locations.size(); i++){
-			if(bursting[i])
-				directions[i].y -= 0.02;
-			locations[i] += directions[i];
-			lifetimes[i] -= time_resolution; // TODO:  Manage time resolutions better
-			if(lifetimes[i] <= 0.0f) {
-				if(bursting[i])
-					create_burst(200, locations[i], 0.003);
-				remove_projectile(i);
-			}
-		}
-		data_mutex.unlock();
-	}
-	void remove_projectile(size_t index){
-		locations.erase(locations.begin() + index);
-		directions.erase(directions.begin() + index);
-		lifetimes.erase(lifetimes.begin() + index);
-		bursting.erase(bursting.begin() + index);
-	}
-	
-	void add_projectile(glm::vec3 location, glm::vec3 direction, float lifetime, bool burst = false){
-		data_mutex.lock();
-		locations.push_back(location);
-		directions.push_back(direction);
-		lifetimes.push_back(lifetime);
-		bursting.push_back(burst);
-		data_mutex.unlock();
-	}
-	void add_projectile(glm::vec3 location, float heading, float elevation, float speed, float lifetime, float offset = 0.0f, bool burst = false){
-		glm::vec3 direction;
-		direction.x = cosf(elevation) * sinf(heading);
-		direction.y = sinf(elevation);
-		direction.z = cosf(elevation) * cosf(heading);
-		location += offset * direction;
-		if(!burst)
-			speed *= 2;
-		direction *= speed;
-		add_projectile(location, direction, lifetime, burst);
-	}
-	void hit_index(size_t idx){
-		directions[idx] = glm::vec3(0, 0, 0);
-// 		directions[idx] = -directions[idx];
-	}
-};
 
-projectile ice_balls;
-
-class fragment : public loaded_object {
-public:
-	std::vector<float> life_counts;
-	std::vector<glm::vec3> trajectories;
-	fragment() : loaded_object("projectile.obj", "brick.jpg", glm::vec3(1.0f, 1.0f, 1.0f)){
-		collision_check = false;
-	}
-	
-	void create_burst(float quantity, glm::vec3 origin, float speed){
-		for(size_t i = 0; i < quantity; i++){
-			locations.push_back(origin);
-			life_counts.push_back(1000.0f);
-			// One note:  This does create a cube of projectiles
-			trajectories.push_back(glm::vec3(randvel(speed), randvel(speed), randvel(speed)));
-		}
-	}
-
-	void move() {
-		for(size_t i = 0; i < locations.size(); i++){
-			life_counts[i] -= 0.1f;
-			locations[i] += trajectories[i];
-			// Is it on the ground?
-			// Import player fall code to make this more elaborate and probably buggy
-			if(locations[i].y <= -9.0){
-				trajectories[i].y = fabs(trajectories[i].y);
-
-				if(fabs(trajectories[i].x) < 0.02)
-					trajectories[i].x = 0.0f;
-				else 
-					trajectories[i].x *= 0.95f;
-
-				if(trajectories[i].y < 0.2)
-					trajectories[i].y = 0.0f;
-				else
-					trajectories[i].y *= 0.8f;
-
-				if(fabs(trajectories[i].z) < 0.02)
-					trajectories[i].z = 0.0f;
-				else
-					trajectories[i].z *= 0.95f;
-
-			} else { 
-				trajectories[i].y -= 0.1;
-			}
-		}
-	}
+		/* Only reads the latest snapshot, never locations, so the simulation can't change it underneath us */
 		void draw(glm::mat4 vp) override {
-			glUseProgram(program);
-			std::vector<glm::mat4> models;
-			models.reserve(locations.size());
-			for(size_t i = 0; i < locations.size(); i++){
-				glm::mat4 new_model = glm::mat4(1.0f);
-				new_model = translate(new_model, locations[i]);
-				if(fabs(trajectories[i].x) > 0.0f || fabs(trajectories[i].z) > 0.0f)
-					new_model = rotate(new_model, life_counts[i], glm::vec3(-trajectories[i].z, 0, trajectories[i].x));
-				models.push_back(new_model);
-			}
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, models_buffer);
-			glBufferData(GL_SHADER_STORAGE_BUFFER, models.size() * sizeof(glm::mat4), models.data(), GL_STATIC_DRAW);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, models_buffer);
-
-			glEnableVertexAttribArray(v_attrib);
-			glBindBuffer(GL_ARRAY_BUFFER, vbuf);
-			glVertexAttribPointer(v_attrib, 3, GL_FLOAT, GL_FALSE, 20, 0);
+			if(batched)
+				return;
+			const instance_snapshot& s = object.snapshots.latest();
+			cull = cull_stats();
+			if(!s.count)
+				return;
+			char* instances = (char*)models_ring.begin(s.data.size());	// Room for all of them, whatever's visible
+			if(!instances)
+				return;
+			glm::vec4 planes[6];
+			frustum_planes(vp, planes);
+			if(cull_instances(s, object.format, mesh, planes, make_lod_view(vp, height), instances, scratch, cull))	// Otherwise the section is just reused next frame
+				draw_instances(vp);
+		}
 
-			glEnableVertexAttribArray(t_attrib);
-			glVertexAttribPointer(t_attrib, 2, GL_FLOAT, GL_FALSE, 20, (const void*)12);
+		/* Everything after the instance data has been written to models_ring, grouped by LOD as cull says */
+		void draw_instances(glm::mat4 vp) {
+			glUseProgram(program);
+			models_ring.bind(0);
+			glBindVertexArray(mesh.vao);
 
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, tex);
 
-			int size;
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebuf);
-			glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-
 			glUniformMatrix4fv(mvp_uniform, 1, 0, glm::value_ptr(vp));
 
-			glDrawElementsInstanced(GL_TRIANGLES, size / sizeof(GLuint), GL_UNSIGNED_INT, 0, locations.size());
-		}
-	
-};
-
-fragment brick_fragments;
-
-class target : public loaded_object {
-public:
-	target() : loaded_object("tex_cube.obj", "beans.jpg", glm::vec3(15.0f, 10.0f, 15.0f)) {
-		collision_check = true;
-	}
-	void hit_index(long index){
-		// Make fragments
-		brick_fragments.create_burst(100, locations[index], 0.01f);
-		locations.erase(locations.begin() + index);
-	}
-	
-};
-
-class elevator : public loaded_object {
-	public:
-		bool up = true;
-
-		elevator(const char* of, const char* tf, glm::vec3 s) : loaded_object(of, tf, s) {}
-		void move(){
-			// Just one elevator for now
-			if(up) {
-				locations[0].y += .1;
-				if(locations[0].y > 100)
-					up = false;
-			} else {
-				locations[0].y -= .1;
-				if(locations[0].y <= 0)
-					up = true;
+			size_t first_instance = 0;
+			for(int k = 0; k < mesh.lod_count; k++) {
+				size_t count = cull.lod_instances[k];
+				if(!count)
+					continue;
+				const void* first_index = (const void*)(mesh.lods[k].first_index * mesh.index_size());
+				glDrawElementsInstancedBaseInstance(GL_TRIANGLES, mesh.lods[k].index_count, mesh.index_type, first_index, count, first_instance);
+				draw_calls++;
+				first_instance += count;
 			}
+			models_ring.finish();
 		}
-		void draw(glm::mat4 vp){
-			loaded_object::draw(vp);
-		}
-};
-
-class turret : public loaded_object {
-public:
-	glm::vec3* player_target; //the player
-	projectile* current_projectile;
-	int countdown = 500;
-	const static int life = 10000;
-	int fire_freq = 0;
-	int p; //used to see which is the most recent for indexing for projectiles
-	
-	bool can_shoot = true;
-	bool not_shot = true;
-	bool movement = true;//not very good name since it'll move no matter what
-
-	turret() : loaded_object("cat.obj", "Cat_bump.jpg", glm::vec3(10, 25, 30)) {//this size isn't a big deal, just collision. Could change
-		collision_check = true;
-	
-	}//hit box is kind of in front of its feet
-	/*Check if got hit: use loaded object method?*/
-	void hit_index(long index) {
-		not_shot = false; // first projectile shot "hits" turret
-	}
-
-	int count = 0;
-	int count_down_count = 60; //i kinda hate these names
-	void move() {
-		if(countdown > 1){
-			countdown--;//Add back the '--', this is just for testing
-			return;
-		}
-		if (fire_freq == 0 && not_shot) {
-			//a weird but succesful way of making the turret not hit itself
-			current_projectile->add_projectile(locations[0] + glm::vec3(0, -25, 0), 0.01f * (*player_target - locations[0] + glm::vec3(0, 25, 0)), life);
-			//printf("%d\n", current_projectile->locations.size());
-
-			fire_freq = count_down_count;
-		}
-
-		/*Movement*/
-		if (movement && not_shot) {
-			locations[0].x += 1;
-			if (locations[0].x > 200)
-				movement = false;
-		}
-		else if(!movement && not_shot){
-			locations[0].x -= 1;
-			if (locations[0].x < -100)
-				movement = true;
-		}
-
-		if (!not_shot && locations[0].y > -100) {
-			locations[0].y -= 1;
-		}
-
-		fire_freq--;
-
-		/*Check if hit player*/
-		//is messing around with globals in here a bad idea?
-		p = current_projectile->locations.size() - 1;
-		for (int i = 0; i < p; i++) {// should check if any of them hit the player
-			if (current_projectile->locations[i].x > player_position.x - 5 && current_projectile->locations[i].x < player_position.x + 5
-				&& current_projectile->locations[i].z > player_position.z - 5 && current_projectile->locations[i].z < player_position.z + 5
-				&& current_projectile->locations[i].y > player_position.y - 5 && current_projectile->locations[i].y < player_position.y + 5) {
-				if (player_speed <= 0.1f)
-					player_dead = true;// could do something cooler here
-				if (!player_dead) {
-					player_speed -= 0.1f;
-					printf("Current player speed : % f\n", player_speed);
-				}
-				puts("Player Hit!");
-				current_projectile->remove_projectile(i);
-				break;
-			}
-		}
-		if (player_dead) {
-			not_shot = false; // not nessesarily shot, but don't want it to shoot
-			locations[0] = player_position + glm::vec3(0, 40, -20);
-		}
-
-		//some weird stuff to make turret gradually speed up shooting
-		if (count == 100) {
-			count = 0;
-			count_down_count -= 1;
-			//this will eventually go down to 0, which will prevent it from shooting
-			//keep for now, cool feature!!
-		}
-		else
-			count++;
-
-
-	}
-	void draw(glm::mat4 vp) {
-		loaded_object::draw(vp);
-	}
-	
 };
 
 #endif
@@ -0,0 +1,10 @@
+#version 460
+
+in vec2 frag_texcoord;
+flat in uint frag_layer;
+out vec4 outcolor;
+uniform sampler2DArray tex;
+
+void main(void) {
+  outcolor = texture(tex, vec3(frag_texcoord, frag_layer));
+}
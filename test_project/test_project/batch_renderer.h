@@ -0,0 +1,388 @@
+#ifndef BATCH_RENDERER_H
+#define BATCH_RENDERER_H
+
+#include<GL/glew.h>
+#include<glm/glm.hpp>
+#include<glm/gtc/type_ptr.hpp>
+#include<vector>
+#include<string.h>
+#include "asset_registry.h"
+#include "instance_ring.h"
+#include "snapshot.h"
+#include "simd_kernels.h"
+
+/* Instances drawn and instances there were as of the last frame, how many of those drawn were
+ * at each LOD and the triangles that came to
+ */
+struct cull_stats {
+	size_t visible = 0, total = 0;
+	size_t lod_instances[MAX_LODS] = {};
+	size_t triangles = 0;
+};
+
+/* How far a LOD may stray from the full mesh on screen, in pixels */
+#define LOD_PIXEL_ERROR 1.0f
+
+/* What picking LODs needs from the view:  the row of vp giving an instance's depth in front of
+ * the camera, and how many pixels one unit covers at depth 1
+ */
+struct lod_view {
+	glm::vec4 depth;
+	float pixels_per_unit;
+};
+inline lod_view make_lod_view(const glm::mat4& vp, float viewport_height) {
+	lod_view v;
+	v.depth = glm::vec4(vp[0][3], vp[1][3], vp[2][3], vp[3][3]);
+	// Row 1 is the camera's up axis scaled by the projection, so its length is that scale
+	v.pixels_per_unit = glm::length(glm::vec3(vp[0][1], vp[1][1], vp[2][1])) * viewport_height / 2;
+	return v;
+}
+
+/* Kept between frames so culling doesn't allocate */
+struct cull_scratch {
+	std::vector<uint32_t> visible;
+	std::vector<uint8_t> lod;
+};
+
+/* Copies the instances of s whose bounding sphere (mesh radius times their scale) touches the
+ * frustum to dst, grouped by LOD:  all of LOD 0's, then LOD 1's and so on, as counted in
+ * stats.lod_instances.  Each instance gets the coarsest LOD whose error comes to no more than
+ * LOD_PIXEL_ERROR on screen.  Mat4 instances don't lead with a position, so they're all copied
+ * at full detail.  Returns how many were copied.
+ */
+inline size_t cull_instances(const instance_snapshot& s, instance_format format, const mesh_descriptor& mesh, const glm::vec4 planes[6], const lod_view& view, char* dst, cull_scratch& scratch, cull_stats& stats) {
+	size_t stride = instance_stride(format);
+	stats = cull_stats();
+	stats.total = s.count;
+	if(format == INSTANCE_MAT4) {
+		memcpy(dst, s.data.data(), s.count * stride);
+		stats.visible = stats.lod_instances[0] = s.count;
+	} else {
+		scratch.visible.resize(s.count);
+		scratch.lod.resize(s.count);
+		stats.visible = cull_spheres(s.data.data(), s.count, stride, mesh.radius, planes, scratch.visible.data());
+
+		// Depth from which each LOD is good enough, at scale 1
+		float lod_depth[MAX_LODS];
+		for(int k = 0; k < mesh.lod_count; k++)
+			lod_depth[k] = mesh.lods[k].error * view.pixels_per_unit / LOD_PIXEL_ERROR;
+		for(size_t i = 0; i < stats.visible; i++) {
+			glm::vec4 p;
+			memcpy(&p, s.data.data() + scratch.visible[i] * stride, sizeof(p));
+			float depth = view.depth.x * p.x + view.depth.y * p.y + view.depth.z * p.z + view.depth.w;
+			int k = 0;
+			while(k + 1 < mesh.lod_count && depth >= lod_depth[k + 1] * p.w)
+				k++;
+			scratch.lod[i] = k;
+			stats.lod_instances[k]++;
+		}
+		size_t at[MAX_LODS];
+		for(int k = 0, n = 0; k < MAX_LODS; n += stats.lod_instances[k++])
+			at[k] = n;
+		for(size_t i = 0; i < stats.visible; i++)
+			memcpy(dst + at[scratch.lod[i]]++ * stride, s.data.data() + scratch.visible[i] * stride, stride);
+	}
+	for(int k = 0; k < mesh.lod_count; k++)
+		stats.triangles += stats.lod_instances[k] * (mesh.lods[k].index_count / 3);
+	return stats.visible;
+}
+
+/* Each texture becomes a BATCH_TEXTURE_SIZE square layer of one array texture */
+#define BATCH_TEXTURE_SIZE 1024
+
+/* Draws many objects that share shaders with one glMultiDrawElementsIndirect per instance
+ * format, instead of a program, texture, VAO and draw per object.
+ * All meshes are copied into one vertex and one index buffer, all textures into layers of one
+ * array texture, and each frame every object's instances go into one ring buffer section along
+ * with the indirect commands and the texture layer for each draw (found with gl_DrawID).
+ * Instances outside the frustum are culled on the way into the ring, and the rest get a
+ * draw per LOD in use.
+ * Objects it won't take (compressed textures, mat4 instances) keep drawing themselves.
+ * GL thread only.
+ */
+class batch_renderer {
+	public:
+		/* Compiles the batch programs.  Nonzero if they didn't build, then don't add anything. */
+		int init(asset_registry& assets) {
+			registry = &assets;
+			for(int f = 0; f < INSTANCE_FORMATS; f++) {
+				if(!vertex_shader_file((instance_format)f))
+					continue;
+				programs[f] = assets.acquire_program(vertex_shader_file((instance_format)f), 0, 0, 0, fragment_shader_file);
+				if(!programs[f]) {
+					destroy();
+					return 1;
+				}
+				vp_uniforms[f] = glGetUniformLocation(programs[f], "vp");
+			}
+			return 0;
+		}
+
+		/* Queues an object for build().  Returns false if it has to keep drawing itself. */
+		bool add(const mesh_descriptor& mesh, GLuint texture, instance_format format, triple_buffer<instance_snapshot>* snapshots, cull_stats* stats) {
+			if(!programs[format] || !texture || !mesh.vao)
+				return false;
+			GLint compressed = 0;	// Can't be a blit source
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+			if(compressed)
+				return false;
+			batch_item item;
+			item.format = format;
+			item.snapshots = snapshots;
+			item.stats = stats;
+			item.mesh = mesh_index(mesh);
+			item.layer = layer_index(texture);
+			items.push_back(item);
+			return true;
+		}
+
+		/* Once everything is added:  builds the shared buffers and array texture */
+		void build() {
+			if(items.empty())
+				return;
+			build_arena();
+			build_texture_array();
+			printf("Batch renderer:  %zu objects, %zu meshes, %zu texture layers\n", items.size(), meshes.size(), textures.size());
+		}
+
+		/* Returns how many draw calls it took */
+		int draw(glm::mat4 vp, float viewport_height) {
+			if(items.empty())
+				return 0;
+			// Commands, then texture layers, then instances, each group of each one aligned for binding
+			GLint align = 256;
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
+			size_t command_bytes[INSTANCE_FORMATS] = {}, layer_bytes[INSTANCE_FORMATS] = {}, instance_bytes[INSTANCE_FORMATS] = {};
+			for(batch_item& item : items) {
+				item.current = &item.snapshots->latest();
+				if(!item.current->count)
+					continue;
+				int lod_count = meshes[item.mesh].source.lod_count;
+				command_bytes[item.format] += lod_count * sizeof(draw_command);
+				layer_bytes[item.format] += lod_count * sizeof(GLuint);
+				instance_bytes[item.format] += item.current->data.size();
+			}
+			size_t command_at[INSTANCE_FORMATS], layer_at[INSTANCE_FORMATS], instance_at[INSTANCE_FORMATS], total = 0;
+			for(int f = 0; f < INSTANCE_FORMATS; f++) {
+				command_at[f] = total;
+				total = round_up(total + command_bytes[f], align);
+			}
+			for(int f = 0; f < INSTANCE_FORMATS; f++) {
+				layer_at[f] = total;
+				total = round_up(total + layer_bytes[f], align);
+			}
+			for(int f = 0; f < INSTANCE_FORMATS; f++) {
+				instance_at[f] = total;
+				total = round_up(total + instance_bytes[f], align);
+			}
+			char* frame = (char*)ring.begin(total);
+			if(!frame)
+				return 0;
+
+			// Space was set aside for every instance, but only the visible ones get copied and drawn
+			glm::vec4 planes[6];
+			frustum_planes(vp, planes);
+			lod_view view = make_lod_view(vp, viewport_height);
+			size_t draws[INSTANCE_FORMATS] = {}, instances[INSTANCE_FORMATS] = {};
+			for(batch_item& item : items) {
+				const instance_snapshot& s = *item.current;
+				int f = item.format;
+				const arena_mesh& m = meshes[item.mesh];
+				size_t stride = instance_stride(item.format);
+				cull_instances(s, item.format, m.source, planes, view, frame + instance_at[f] + instances[f] * stride, scratch, *item.stats);
+				for(int k = 0; k < m.source.lod_count; k++) {
+					size_t count = item.stats->lod_instances[k];
+					if(!count)
+						continue;
+					const mesh_lod& lod = m.source.lods[k];
+					draw_command c = {lod.index_count, (GLuint)count, (GLuint)(m.first_index + lod.first_index), (GLint)m.base_vertex, (GLuint)instances[f]};
+					memcpy(frame + command_at[f] + draws[f] * sizeof(draw_command), &c, sizeof(c));
+					memcpy(frame + layer_at[f] + draws[f] * sizeof(GLuint), &item.layer, sizeof(GLuint));
+					draws[f]++;
+					instances[f] += count;
+				}
+			}
+
+			size_t base = ring.section_offset();
+			glBindVertexArray(vao);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.buffer);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, texture_array);
+			int calls = 0;
+			for(int f = 0; f < INSTANCE_FORMATS; f++) {
+				if(!draws[f])
+					continue;
+				glUseProgram(programs[f]);
+				glUniformMatrix4fv(vp_uniforms[f], 1, 0, glm::value_ptr(vp));
+				glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, ring.buffer, base + instance_at[f], instance_bytes[f]);
+				glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, ring.buffer, base + layer_at[f], layer_bytes[f]);
+				glMultiDrawElementsIndirect(GL_TRIANGLES, index_type, (const void*)(base + command_at[f]), draws[f], 0);
+				calls++;
+			}
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			ring.finish();
+			return calls;
+		}
+
+		void destroy() {
+			ring.destroy();
+			for(int f = 0; f < INSTANCE_FORMATS; f++)
+				if(programs[f])
+					registry->release_program(vertex_shader_file((instance_format)f), 0, 0, 0, fragment_shader_file);
+			memset(programs, 0, sizeof(programs));
+			glDeleteVertexArrays(1, &vao);
+			glDeleteBuffers(1, &vbuf);
+			glDeleteBuffers(1, &ebuf);
+			glDeleteTextures(1, &texture_array);
+			vao = vbuf = ebuf = texture_array = 0;
+			items.clear();
+			meshes.clear();
+			textures.clear();
+		}
+
+	private:
+		struct draw_command {	// Laid out as GL reads it from the indirect buffer
+			GLuint count, instance_count, first_index;
+			GLint base_vertex;
+			GLuint base_instance;
+		};
+		struct arena_mesh {
+			mesh_descriptor source;
+			size_t first_index = 0, index_count = 0, base_vertex = 0;	// index_count covers every LOD
+		};
+		struct batch_item {
+			instance_format format;
+			triple_buffer<instance_snapshot>* snapshots;
+			const instance_snapshot* current = 0;	// This frame's
+			cull_stats* stats;
+			size_t mesh;
+			GLuint layer;
+		};
+		static constexpr const char* fragment_shader_file = "batch_fragment_shader.glsl";
+		asset_registry* registry = 0;
+		GLuint programs[INSTANCE_FORMATS] = {};
+		GLint vp_uniforms[INSTANCE_FORMATS] = {};
+		std::vector<batch_item> items;
+		std::vector<arena_mesh> meshes;
+		std::vector<GLuint> textures;	// layer -> source texture
+		GLuint vao = 0, vbuf = 0, ebuf = 0, texture_array = 0;
+		GLenum index_type = GL_UNSIGNED_SHORT;
+		instance_ring ring;
+		cull_scratch scratch;
+
+		static const char* vertex_shader_file(instance_format format) {
+			switch(format) {
+				case INSTANCE_VEC4:	return "batch_vec4_vertex_shader.glsl";
+				case INSTANCE_QUAT:	return "batch_quat_vertex_shader.glsl";
+				default:		return 0;
+			}
+		}
+		static size_t round_up(size_t n, size_t align) {
+			return (n + align - 1) / align * align;
+		}
+
+		size_t mesh_index(const mesh_descriptor& mesh) {
+			for(size_t i = 0; i < meshes.size(); i++)
+				if(meshes[i].source.vao == mesh.vao)
+					return i;
+			arena_mesh m;
+			m.source = mesh;
+			meshes.push_back(m);
+			return meshes.size() - 1;
+		}
+		GLuint layer_index(GLuint texture) {
+			for(size_t i = 0; i < textures.size(); i++)
+				if(textures[i] == texture)
+					return i;
+			textures.push_back(texture);
+			return textures.size() - 1;
+		}
+
+		/* Read the meshes back and pack them into one buffer pair.  Indices stay relative to
+		 * their own mesh (base_vertex does the rest), so 16 bits do as long as every mesh fits.
+		 */
+		void build_arena() {
+			index_type = GL_UNSIGNED_SHORT;
+			for(arena_mesh& m : meshes)
+				if(m.source.vertex_count > 0x10000)
+					index_type = GL_UNSIGNED_INT;
+			std::vector<vertex> vertices;
+			std::vector<uint32_t> indices;
+			for(arena_mesh& m : meshes) {
+				const mesh_descriptor& src = m.source;
+				m.base_vertex = vertices.size();
+				m.first_index = indices.size();
+				m.index_count = src.index_count;
+				vertices.resize(vertices.size() + src.vertex_count);
+				glBindBuffer(GL_ARRAY_BUFFER, src.vbuf);
+				glGetBufferSubData(GL_ARRAY_BUFFER, 0, src.vertex_count * sizeof(vertex), &vertices[m.base_vertex]);
+				std::vector<char> raw(src.index_count * src.index_size());
+				glBindVertexArray(src.vao);	// For its index buffer
+				glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, raw.size(), raw.data());
+				for(size_t i = 0; i < src.index_count; i++)
+					indices.push_back(src.index_type == GL_UNSIGNED_SHORT ? ((uint16_t*)raw.data())[i] : ((uint32_t*)raw.data())[i]);
+			}
+			glBindVertexArray(0);
+
+			mesh_descriptor arena;
+			glGenBuffers(1, &arena.vbuf);
+			glBindBuffer(GL_ARRAY_BUFFER, arena.vbuf);
+			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex), vertices.data(), GL_STATIC_DRAW);
+			glGenBuffers(1, &arena.ebuf);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.ebuf);
+			if(index_type == GL_UNSIGNED_SHORT) {
+				std::vector<uint16_t> short_indices(indices.begin(), indices.end());
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, short_indices.size() * sizeof(uint16_t), short_indices.data(), GL_STATIC_DRAW);
+			} else {
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+			}
+			arena.make_vao();
+			vao = arena.vao;
+			vbuf = arena.vbuf;
+			ebuf = arena.ebuf;
+		}
+
+		/* Blit each texture into its layer from the mip level nearest the layer size, then mip the array */
+		void build_texture_array() {
+			GLsizei levels = 1;
+			while((BATCH_TEXTURE_SIZE >> levels) > 0)
+				levels++;
+			glGenTextures(1, &texture_array);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, texture_array);
+			glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGB8, BATCH_TEXTURE_SIZE, BATCH_TEXTURE_SIZE, textures.size());
+
+			GLint previous_framebuffer = 0;	// Not necessarily the window's, when rendering offscreen
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+			GLuint fbos[2];
+			glGenFramebuffers(2, fbos);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]);
+			for(size_t layer = 0; layer < textures.size(); layer++) {
+				GLint width, height;
+				glBindTexture(GL_TEXTURE_2D, textures[layer]);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+				int level = 0;
+				while((width >> (level + 1)) >= BATCH_TEXTURE_SIZE && (height >> (level + 1)) >= BATCH_TEXTURE_SIZE)
+					level++;
+				glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[layer], level);
+				glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture_array, 0, layer);
+				glBlitFramebuffer(0, 0, width >> level, height >> level, 0, 0, BATCH_TEXTURE_SIZE, BATCH_TEXTURE_SIZE, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+			}
+			glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+			glDeleteFramebuffers(2, fbos);
+
+			glBindTexture(GL_TEXTURE_2D_ARRAY, texture_array);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			if(GLEW_EXT_texture_filter_anisotropic) {
+				float max_anisotropy = 1.0f;
+				glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_anisotropy);
+				glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, max_anisotropy < MAX_ANISOTROPY ? max_anisotropy : MAX_ANISOTROPY);
+			}
+		}
+};
+
+#endif
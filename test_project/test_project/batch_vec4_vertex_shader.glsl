@@ -0,0 +1,22 @@
+#version 460
+
+// Batched version of loaded_object_vec4_vertex_shader:  every draw's instances are in one list,
+// starting at its base instance, and it picks its texture layer by gl_DrawID
+layout(std430, binding=0) buffer instance_list {
+	vec4 instances[];
+};
+layout(std430, binding=1) buffer draw_list {
+	uint layers[];
+};
+layout(location = 0) in vec3 in_vertex;
+layout(location = 1) in vec2 in_texcoord;
+uniform mat4 vp;
+out vec2 frag_texcoord;
+flat out uint frag_layer;
+
+void main(void) {	
+	vec4 instance = instances[gl_BaseInstance + gl_InstanceID];
+	gl_Position = vp * vec4(in_vertex * instance.w + instance.xyz, 1.0);
+	frag_texcoord = in_texcoord;
+	frag_layer = layers[gl_DrawID];
+}
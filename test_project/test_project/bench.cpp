@@ -0,0 +1,435 @@
+/* Micro benchmarks for engine hot paths.  These don't need a GL context.
+ * Build with "make bench", run "./bench" for everything or "./bench <name>" for one.
+ */
+
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<glm/glm.hpp>
+#include<glm/gtx/hash.hpp>
+#include<glm/gtc/matrix_transform.hpp>
+#include<vector>
+#include<unordered_map>
+#include<chrono>
+#include "spatial_grid.h"
+#include "job_system.h"
+#include "instance_handles.h"
+#include "simd_kernels.h"
+#include "mesh_tools.h"
+#include "tiny_obj_loader.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double ms_since(bench_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static float frand(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+/* Same test loaded_object::collision_index used to do for every instance */
+static long linear_collision(const std::vector<glm::vec3>& locations, glm::vec3 size, glm::vec3 position, float distance) {
+	for(long i = 0; i < (long)locations.size(); i++){
+		glm::vec3 l = locations[i];
+		if(	size.x/2.0f + distance > fabsf(l.x-position.x) &&
+				size.y/2.0f + distance > fabsf(l.y-position.y) &&
+				size.z/2.0f + distance > fabsf(l.z-position.z))
+			return i;
+	}
+	return -1;
+}
+
+static void bench_grid() {
+	const glm::vec3 size(15.0f, 10.0f, 15.0f); // target
+	const size_t queries = 10000;
+	size_t counts[] = {1000, 10000, 100000};
+	puts("grid:  collision_index, linear scan vs spatial grid");
+	for(size_t n : counts) {
+		// Keep density roughly constant so the hit rate doesn't change with n
+		float extent = 20.0f * cbrtf((float)n);
+		std::vector<glm::vec3> locations(n);
+		for(glm::vec3& l : locations)
+			l = glm::vec3(frand(-extent, extent), frand(-extent, extent), frand(-extent, extent));
+		std::vector<glm::vec3> points(queries);
+		for(glm::vec3& p : points)
+			p = glm::vec3(frand(-extent, extent), frand(-extent, extent), frand(-extent, extent));
+
+		auto start = bench_clock::now();
+		long linear_hits = 0;
+		for(glm::vec3 p : points)
+			linear_hits += linear_collision(locations, size, p, 0) != -1;
+		double linear_ms = ms_since(start);
+
+		start = bench_clock::now();
+		spatial_grid grid;
+		grid.build(locations, 15.0f);
+		double build_ms = ms_since(start);
+
+		start = bench_clock::now();
+		long grid_hits = 0, mismatches = 0;
+		glm::vec3 half = size / 2.0f;
+		std::vector<long> results(queries);
+		for(size_t q = 0; q < queries; q++) {
+			glm::vec3 p = points[q];
+			results[q] = grid.query(p - half, p + half, [&](size_t i) {
+				glm::vec3 l = locations[i];
+				return	half.x > fabsf(l.x-p.x) && half.y > fabsf(l.y-p.y) && half.z > fabsf(l.z-p.z);
+			});
+		}
+		double grid_ms = ms_since(start);
+		for(size_t q = 0; q < queries; q++) {
+			grid_hits += results[q] != -1;
+			mismatches += results[q] != linear_collision(locations, size, points[q], 0);
+		}
+
+		printf("  %7zu instances:  linear %9.3f ms   grid %8.3f ms (build %.3f ms)   hits %ld/%ld   mismatches %ld\n",
+				n, linear_ms, grid_ms, build_ms, linear_hits, grid_hits, mismatches);
+	}
+}
+
+/* One simulation tick's worth of projectile work:  integrate like projectile::move, then look for
+ * hits against a target grid like collision_detection.
+ */
+static void bench_jobs() {
+	const size_t projectiles = 100000, targets = 1000, ticks = 100;
+	const glm::vec3 half(7.5f, 5.0f, 7.5f);
+	std::vector<glm::vec3> locations(projectiles), directions(projectiles), target_locations(targets);
+	std::vector<float> lifetimes(projectiles, 10000.0f);
+	std::vector<char> bursting(projectiles), hits(projectiles);
+	for(size_t i = 0; i < projectiles; i++) {
+		locations[i] = glm::vec3(frand(-500, 500), frand(0, 100), frand(-500, 500));
+		directions[i] = glm::vec3(frand(-1, 1), frand(-1, 1), frand(-1, 1));
+		bursting[i] = i % 2;
+	}
+	for(glm::vec3& t : target_locations)
+		t = glm::vec3(frand(-500, 500), frand(0, 100), frand(-500, 500));
+	spatial_grid grid;
+	grid.build(target_locations, 15.0f);
+
+	printf("jobs:  %zu projectiles vs %zu targets, %zu ticks\n", projectiles, targets, ticks);
+	unsigned worker_counts[] = {1, 2, 4, 8};
+	double single = 0;
+	for(unsigned workers : worker_counts) {
+		job_system js;
+		js.start(workers);
+		auto start = bench_clock::now();
+		for(size_t t = 0; t < ticks; t++) {
+			js.parallel_for(0, projectiles, JOB_GRAIN, [&](size_t lo, size_t hi) {
+				for(size_t i = lo; i < hi; i++) {
+					if(bursting[i])
+						directions[i].y -= 0.02f;
+					locations[i] += directions[i];
+					lifetimes[i] -= 10;
+				}
+			});
+			js.parallel_for(0, projectiles, JOB_GRAIN / 4, [&](size_t lo, size_t hi) {
+				for(size_t i = lo; i < hi; i++) {
+					glm::vec3 p = locations[i];
+					hits[i] = grid.query(p - half, p + half, [&](size_t k) {
+						glm::vec3 l = target_locations[k];
+						return half.x > fabsf(l.x-p.x) && half.y > fabsf(l.y-p.y) && half.z > fabsf(l.z-p.z);
+					}) != -1;
+				}
+			});
+		}
+		double ms = ms_since(start) / ticks;
+		if(workers == 1)
+			single = ms;
+		printf("  %u workers:  %8.3f ms/tick   speedup %.2fx\n", workers, ms, single / ms);
+	}
+}
+
+/* Projectile-shaped arrays, removed from either the old way (vector::erase) or with swap_pop */
+struct removal_arrays {
+	std::vector<glm::vec3> locations, directions;
+	std::vector<float> lifetimes;
+	std::vector<bool> bursting;
+	instance_handles handles;
+
+	void add_burst(size_t quantity) {
+		for(size_t i = 0; i < quantity; i++) {
+			locations.push_back(glm::vec3(frand(-1, 1), frand(-1, 1), frand(-1, 1)));
+			directions.push_back(glm::vec3(0, 0, 0));
+			lifetimes.push_back(frand(0, 100));
+			bursting.push_back(false);
+			handles.add();
+		}
+	}
+	void erase(size_t i) {
+		locations.erase(locations.begin() + i);
+		directions.erase(directions.begin() + i);
+		lifetimes.erase(lifetimes.begin() + i);
+		bursting.erase(bursting.begin() + i);
+	}
+	void swap_remove(size_t i) {
+		swap_pop(locations, i);
+		swap_pop(directions, i);
+		swap_pop(lifetimes, i);
+		swap_pop(bursting, i);
+		handles.remove(i);
+	}
+	/* Expire everything under cutoff, like projectile::move does, then burst again */
+	template<typename F>
+	void tick(float cutoff, F remove) {
+		for(long i = (long)locations.size() - 1; i >= 0; i--)
+			if(lifetimes[i] < cutoff)
+				remove(i);
+		for(int b = 0; b < 10; b++)
+			add_burst(200); // create_burst(200, ...)
+		for(float& l : lifetimes)
+			l = frand(0, 100);
+	}
+};
+
+static void bench_removal() {
+	size_t counts[] = {10000, 100000};
+	const int rounds = 20;
+	puts("removal:  expire ~2% per tick then add 10 bursts of 200, vector::erase vs swap_pop");
+	for(size_t n : counts) {
+		removal_arrays erase_arrays, swap_arrays;
+		srand(99);
+		erase_arrays.add_burst(n);
+		srand(99);
+		swap_arrays.add_burst(n);
+
+		srand(7);
+		auto start = bench_clock::now();
+		for(int r = 0; r < rounds; r++)
+			erase_arrays.tick(2.0f, [&](size_t i) { erase_arrays.erase(i); });
+		double erase_ms = ms_since(start) / rounds;
+
+		srand(7);
+		start = bench_clock::now();
+		for(int r = 0; r < rounds; r++)
+			swap_arrays.tick(2.0f, [&](size_t i) { swap_arrays.swap_remove(i); });
+		double swap_ms = ms_since(start) / rounds;
+
+		printf("  %7zu projectiles:  erase %9.3f ms/tick   swap_pop %7.3f ms/tick   (%zu vs %zu left)\n",
+				n, erase_ms, swap_ms, erase_arrays.locations.size(), swap_arrays.locations.size());
+	}
+}
+
+/* The per-element loop projectile::move used, against the SoA kernel at each SIMD level */
+static void bench_integrate() {
+	size_t counts[] = {100000, 1000000};
+	const int iterations = 50;
+	printf("integrate:  projectile integration, %d steps (this CPU supports %s)\n", iterations, simd_level_name(detected_simd_level()));
+	for(size_t n : counts) {
+		std::vector<glm::vec3> locations(n), directions(n);
+		std::vector<float> lifetimes(n);
+		std::vector<bool> bursting(n);
+		particle_soa particles;
+		for(size_t i = 0; i < n; i++) {
+			locations[i] = glm::vec3(frand(-100, 100), frand(-100, 100), frand(-100, 100));
+			directions[i] = glm::vec3(frand(-1, 1), frand(-1, 1), frand(-1, 1));
+			lifetimes[i] = 1e9f;
+			bursting[i] = rand() % 2;
+			particles.push(locations[i], directions[i], lifetimes[i], bursting[i]);
+		}
+		std::vector<uint8_t> expired(n);
+
+		auto start = bench_clock::now();
+		size_t dead = 0;
+		for(int it = 0; it < iterations; it++)
+			for(size_t i = 0; i < n; i++) {
+				if(bursting[i])
+					directions[i].y -= 0.02f;
+				locations[i] += directions[i];
+				lifetimes[i] -= 10;
+				dead += lifetimes[i] <= 0.0f;
+			}
+		printf("  %8zu particles:  per-element %8.3f ms/step", n, ms_since(start) / iterations);
+
+		simd_level levels[] = {SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2};
+		for(simd_level level : levels) {
+			if(level > detected_simd_level())
+				continue;
+			use_simd_level(level);
+			start = bench_clock::now();
+			for(int it = 0; it < iterations; it++)
+				dead += integrate_particles(particles, 0, n, 0.02f, 10, expired.data());
+			printf("   %s %7.3f", simd_level_name(level), ms_since(start) / iterations);
+		}
+		use_simd_level(detected_simd_level());
+		printf("   (%zu expired)\n", dead);
+	}
+}
+
+/* collision_index's scalar early-out loop against the SIMD box kernel */
+static void bench_aabb() {
+	size_t box_counts[] = {64, 256, 1024};
+	const size_t queries = 100000;
+	const glm::vec3 size(15.0f, 10.0f, 15.0f);
+	printf("aabb:  %zu projectiles against M boxes\n", queries);
+	for(size_t m : box_counts) {
+		float extent = 20.0f * cbrtf((float)m);
+		std::vector<glm::vec3> locations(m), points(queries);
+		aabb_soa boxes;
+		for(glm::vec3& l : locations) {
+			l = glm::vec3(frand(-extent, extent), frand(-extent, extent), frand(-extent, extent));
+			boxes.push(l, size / 2.0f);
+		}
+		for(glm::vec3& p : points)
+			p = glm::vec3(frand(-extent, extent), frand(-extent, extent), frand(-extent, extent));
+
+		std::vector<long> expected(queries), first_hit(queries);
+		auto start = bench_clock::now();
+		for(size_t q = 0; q < queries; q++)
+			expected[q] = linear_collision(locations, size, points[q], 0);
+		printf("  %5zu boxes:  scalar loop %8.3f ms", m, ms_since(start));
+
+		simd_level levels[] = {SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2};
+		for(simd_level level : levels) {
+			if(level > detected_simd_level())
+				continue;
+			use_simd_level(level);
+			start = bench_clock::now();
+			aabb_first_hits(boxes, points.data(), queries, first_hit.data());
+			double ms = ms_since(start);
+			long mismatches = 0;
+			for(size_t q = 0; q < queries; q++)
+				mismatches += first_hit[q] != expected[q];
+			printf("   %s %7.3f (%ld wrong)", simd_level_name(level), ms, mismatches);
+		}
+		use_simd_level(detected_simd_level());
+		puts("");
+	}
+}
+
+/* What load_model used to do:  std::unordered_map, XOR of the glm hashes, two lookups per corner */
+struct xor_vertex_hash {
+	size_t operator()(const vertex& v) const {
+		return std::hash<glm::vec3>()(v.pos) ^ (std::hash<glm::vec2>()(v.tex_coord) << 1);
+	}
+};
+template<typename F>
+static void unordered_map_dedup(const std::vector<size_t>& shape_sizes, F corner, std::vector<vertex>& vertices, std::vector<uint32_t>& indices) {
+	std::unordered_map<vertex, uint32_t, xor_vertex_hash> unique_vertices;
+	for(size_t s = 0; s < shape_sizes.size(); s++)
+		for(size_t i = 0; i < shape_sizes[s]; i++) {
+			vertex v = corner(s, i);
+			if(unique_vertices.count(v) == 0) {
+				unique_vertices[v] = (uint32_t)vertices.size();
+				vertices.push_back(v);
+			}
+			indices.push_back(unique_vertices[v]);
+		}
+}
+
+template<typename F>
+static void compare_dedup(const char* name, const std::vector<size_t>& shape_sizes, F corner, job_system& js) {
+	std::vector<vertex> expected_vertices, vertices;
+	std::vector<uint32_t> expected_indices, indices;
+	auto start = bench_clock::now();
+	unordered_map_dedup(shape_sizes, corner, expected_vertices, expected_indices);
+	printf("  %-22s %8zu corners -> %7zu vertices:  unordered_map %8.2f ms", name, expected_indices.size(), expected_vertices.size(), ms_since(start));
+
+	start = bench_clock::now();
+	dedup_vertices(shape_sizes, corner, vertices, indices);
+	double ms = ms_since(start);
+	bool same = vertices.size() == expected_vertices.size() && indices == expected_indices;
+	printf("   flat %8.2f%s", ms, same ? "" : " (MISMATCH)");
+
+	vertices.clear();
+	indices.clear();
+	start = bench_clock::now();
+	dedup_vertices_parallel(js, shape_sizes, corner, vertices, indices);
+	ms = ms_since(start);
+	same = vertices.size() == expected_vertices.size() && indices == expected_indices;
+	printf("   parallel %8.2f%s\n", ms, same ? "" : " (MISMATCH)");
+}
+
+static void bench_dedup() {
+	job_system js;
+	js.start();
+	printf("dedup:  load_model vertex deduplication, %u workers\n", js.worker_count());
+
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+	if(tinyobj::LoadObj(&attrib, &shapes, &materials, &err, "monkey.obj")) {
+		std::vector<size_t> shape_sizes;
+		for(const tinyobj::shape_t& shape : shapes)
+			shape_sizes.push_back(shape.mesh.indices.size());
+		compare_dedup("monkey.obj", shape_sizes, [&](size_t s, size_t i) {
+			const tinyobj::index_t& index = shapes[s].mesh.indices[i];
+			vertex v = {};
+			v.pos = glm::vec3(attrib.vertices[3*index.vertex_index], attrib.vertices[3*index.vertex_index + 1], attrib.vertices[3*index.vertex_index + 2]);
+			v.tex_coord = glm::vec2(attrib.texcoords[2*index.texcoord_index], 1.0f - attrib.texcoords[2*index.texcoord_index + 1]);
+			return v;
+		}, js);
+	} else {
+		printf("  Couldn't load monkey.obj (run from the project directory):  %s\n", err.c_str());
+	}
+
+	// A grid of 708x708 vertices is 1,000,000 triangles, cut into horizontal bands as shapes
+	const size_t side = 708, quads = side - 1, bands = 16;
+	std::vector<size_t> shape_sizes;
+	for(size_t b = 0; b < bands; b++)
+		shape_sizes.push_back((quads * (b + 1) / bands - quads * b / bands) * quads * 6);
+	compare_dedup("1M triangle grid", shape_sizes, [&](size_t s, size_t i) {
+		static const int corner_x[6] = {0, 1, 1, 1, 0, 0}, corner_y[6] = {0, 0, 1, 1, 1, 0};
+		size_t quad = i / 6, k = i % 6;
+		size_t x = quad % quads + corner_x[k], y = quads * s / bands + quad / quads + corner_y[k];
+		vertex v = {};
+		v.pos = glm::vec3(x * 0.1f, sinf(x * 0.05f) * cosf(y * 0.05f), y * 0.1f);
+		v.tex_coord = glm::vec2(x / (float)quads, y / (float)quads);
+		return v;
+	}, js);
+}
+
+/* Frustum culling the floor's 10000 tiles, and a field of scattered instances, at each level */
+static void bench_cull() {
+	const size_t count = 100000;
+	const int rounds = 100;
+	glm::mat4 vp = glm::perspective(45.0f, 2600.0f / 1550.0f, 0.1f, 10000.0f) *
+		glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0));
+	glm::vec4 planes[6];
+	frustum_planes(vp, planes);
+
+	std::vector<glm::vec4> instances(count);
+	for(glm::vec4& i : instances)
+		i = glm::vec4(frand(-1000, 1000), frand(-100, 100), frand(-1000, 1000), 1.0f);
+	std::vector<uint32_t> visible(count);
+	printf("cull:  %zu instances x %d rounds\n", count, rounds);
+	simd_level levels[] = {SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2};
+	for(simd_level level : levels) {
+		if(level > detected_simd_level())
+			continue;
+		use_simd_level(level);
+		size_t n = 0;
+		auto start = bench_clock::now();
+		for(int r = 0; r < rounds; r++)
+			n = cull_spheres(instances.data(), count, sizeof(glm::vec4), 2.0f, planes, visible.data());
+		double ms = ms_since(start);
+		printf("  %-6s %8.3f ms per round, %.2f ns per instance, %zu visible\n", simd_level_name(level), ms / rounds, 1e6 * ms / rounds / count, n);
+	}
+	use_simd_level(detected_simd_level());
+}
+
+struct bench_entry {
+	const char* name;
+	void (*run)();
+};
+
+static bench_entry benches[] = {
+	{"grid", bench_grid},
+	{"jobs", bench_jobs},
+	{"removal", bench_removal},
+	{"integrate", bench_integrate},
+	{"aabb", bench_aabb},
+	{"dedup", bench_dedup},
+	{"cull", bench_cull},
+};
+
+int main(int argc, char** argv) {
+	srand(1234);
+	for(bench_entry& b : benches)
+		if(argc < 2 || !strcmp(argv[1], b.name))
+			b.run();
+	return 0;
+}
@@ -1,15 +1,20 @@
 #version 460
 
-in vec3 in_vertex;
-in vec2 in_texcoord;
+layout(location = 0) in vec3 in_vertex;
+layout(location = 1) in vec2 in_texcoord;
 uniform mat4 mvp;
 out vec4 fcolor;
-out vec4 gl_Position;
 out vec2 f_texcoord;
 
+// Tiles that survived culling, one per instance
+layout(std430, binding=0) buffer visible_tiles {
+	uint tiles[];
+};
+
 void main(void) {	
-	int x_offset = 2 * (gl_InstanceID / 100) - 100;
-	int z_offset = 2 * (gl_InstanceID % 100) - 100;
+	int tile = int(tiles[gl_InstanceID]);
+	int x_offset = 2 * (tile / 100) - 100;
+	int z_offset = 2 * (tile % 100) - 100;
 	vec4 instance_point = vec4(in_vertex.x + float(x_offset), in_vertex.y, in_vertex.z + float(z_offset), 1.0);
 	instance_point.xz *= 5;
 	gl_Position = mvp * instance_point;
@@ -2,6 +2,7 @@
 #define GAME_H
 
 #include<vector>
+#include<cstdint>
 
 
 struct vertex {
@@ -13,8 +14,48 @@ struct vertex {
 	}
 }; // __attribute__((packed)); // TODO:  Alignment
 
-unsigned int load_texture(const char* filename);
-int load_model(std::vector<vertex>& verticies, std::vector<uint32_t>& indices, const char* filename, float scale, bool swap_yz);
+/* A level of detail:  a range of a mesh's indices drawing the same vertices with fewer
+ * triangles.  error is roughly how far it strays from the full mesh, in model units.
+ */
+#define MAX_LODS 4
+struct mesh_lod {
+	uint32_t first_index, index_count;
+	float error;
+};
+
+/* Highest anisotropic filtering upload_texture asks for */
+#define MAX_ANISOTROPY 16.0f
+
+struct image_level {
+	int width = 0, height = 0;
+	std::vector<unsigned char> data;
+};
+/* A decoded texture with its full mip chain, level 0 first, from decode_texture */
+struct image_data {
+	int width = 0, height = 0;
+	bool bc1 = false;	// levels hold BC1 blocks rather than RGB rows
+	std::vector<image_level> levels;
+};
+
+unsigned int load_texture(const char* filename, bool bc1 = false);
+bool decode_texture(const char* filename, image_data& image, bool bc1 = false);
+unsigned int upload_texture(const image_data& image);
+/* Shapes are deduplicated in parallel on jobs, if given.  With lods, indices holds every level
+ * of detail back to back and lods says where each is (full detail first).  Without, just the
+ * full detail mesh.
+ */
+class job_system;
+int load_model(std::vector<vertex>& verticies, std::vector<uint32_t>& indices, const char* filename, float scale, bool swap_yz, job_system* jobs = 0, std::vector<mesh_lod>* lods = 0);
+
+/* Hashes the contents of count files, in order.  Null entries are skipped but still count as a
+ * position.  False if one can't be read.
+ */
+bool hash_files(const char* const* files, int count, uint64_t& hash);
+/* Linked program from the binary cache at path, or 0 if it's missing, out of date or the driver
+ * won't have it.  GL thread only, like save_program_binary.
+ */
+unsigned int load_program_binary(const char* path, uint64_t source_hash);
+void save_program_binary(unsigned int program, const char* path, uint64_t source_hash);
 
 
 
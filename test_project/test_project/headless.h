@@ -0,0 +1,155 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include<GL/glew.h>
+#include<stdio.h>
+#include<string.h>
+#include<vector>
+#include<algorithm>
+#ifndef _WIN32
+#include<EGL/egl.h>
+#include<EGL/eglext.h>
+#endif
+
+/* A GL context with no window, rendering into an offscreen framebuffer, for benchmarking on
+ * machines without a display.  Uses EGL:  Mesa's surfaceless platform if it's there (which
+ * works with llvmpipe and no GPU at all), otherwise the default display with a 1x1 pbuffer
+ * just to make the context current.  Everything is drawn to fbo, never shown.
+ * Call init before glewInit, like creating a window.
+ */
+class headless_context {
+	public:
+		GLuint fbo = 0, color = 0, depth = 0;
+
+		/* Nonzero if there's no usable context */
+		int init() {
+#ifdef _WIN32
+			puts("Headless mode needs EGL, which isn't supported on Windows");
+			return 1;
+#else
+			display = EGL_NO_DISPLAY;
+			const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+			if(extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+				PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+				if(get_platform_display)
+					display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+			}
+			if(display == EGL_NO_DISPLAY)
+				display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+			EGLint major, minor;
+			if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+				printf("No EGL display (error 0x%x)\n", eglGetError());
+				return 1;
+			}
+			printf("EGL %d.%d, %s\n", major, minor, eglQueryString(display, EGL_VENDOR));
+			if(!eglBindAPI(EGL_OPENGL_API)) {
+				puts("EGL can't do desktop OpenGL");
+				return 1;
+			}
+
+			const EGLint config_attributes[] = {
+				EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+				EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+				EGL_NONE,
+			};
+			EGLConfig config;
+			EGLint configs = 0;
+			if(!eglChooseConfig(display, config_attributes, &config, 1, &configs) || !configs) {
+				puts("No EGL config for an OpenGL pbuffer");
+				return 1;
+			}
+			// The shaders are #version 460, but take whatever the driver has and let them fail to compile if it's not enough
+			const EGLint context_attributes[] = {
+				EGL_CONTEXT_MAJOR_VERSION, 4,
+				EGL_CONTEXT_MINOR_VERSION, 6,
+				EGL_NONE,
+			};
+			context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+			if(context == EGL_NO_CONTEXT)
+				context = eglCreateContext(display, config, EGL_NO_CONTEXT, 0);
+			if(context == EGL_NO_CONTEXT) {
+				printf("Couldn't create an OpenGL context (error 0x%x)\n", eglGetError());
+				return 1;
+			}
+
+			// The framebuffer below is all we draw to, so a surface is only needed if the display insists
+			const char* display_extensions = eglQueryString(display, EGL_EXTENSIONS);
+			if(!display_extensions || !strstr(display_extensions, "EGL_KHR_surfaceless_context")) {
+				const EGLint pbuffer_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+				surface = eglCreatePbufferSurface(display, config, pbuffer_attributes);
+				if(surface == EGL_NO_SURFACE) {
+					printf("Couldn't create a pbuffer (error 0x%x)\n", eglGetError());
+					return 1;
+				}
+			}
+			if(!eglMakeCurrent(display, surface, surface, context)) {
+				printf("Couldn't make the EGL context current (error 0x%x)\n", eglGetError());
+				return 1;
+			}
+			return 0;
+#endif
+		}
+
+		/* After glewInit:  the offscreen framebuffer, bound for drawing */
+		int make_framebuffer(int width, int height) {
+			glGenRenderbuffers(1, &color);
+			glBindRenderbuffer(GL_RENDERBUFFER, color);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+			glGenRenderbuffers(1, &depth);
+			glBindRenderbuffer(GL_RENDERBUFFER, depth);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+			glGenFramebuffers(1, &fbo);
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+			if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+				puts("Offscreen framebuffer incomplete");
+				return 1;
+			}
+			glViewport(0, 0, width, height);
+			printf("Rendering offscreen at %dx%d:  %s\n", width, height, (const char*)glGetString(GL_RENDERER));
+			return 0;
+		}
+
+		void destroy() {
+			if(fbo) {
+				glBindFramebuffer(GL_FRAMEBUFFER, 0);
+				glDeleteFramebuffers(1, &fbo);
+				glDeleteRenderbuffers(1, &color);
+				glDeleteRenderbuffers(1, &depth);
+				fbo = color = depth = 0;
+			}
+#ifndef _WIN32
+			if(display != EGL_NO_DISPLAY) {
+				eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+				if(surface != EGL_NO_SURFACE)
+					eglDestroySurface(display, surface);
+				if(context != EGL_NO_CONTEXT)
+					eglDestroyContext(display, context);
+				eglTerminate(display);
+				display = EGL_NO_DISPLAY;
+			}
+#endif
+		}
+
+	private:
+#ifndef _WIN32
+		EGLDisplay display = EGL_NO_DISPLAY;
+		EGLContext context = EGL_NO_CONTEXT;
+		EGLSurface surface = EGL_NO_SURFACE;
+#endif
+};
+
+/* Prints min/mean/percentiles/max of a set of per-frame times, in milliseconds */
+inline void print_frame_stats(const char* name, std::vector<double> ms) {
+	if(ms.empty())
+		return;
+	std::sort(ms.begin(), ms.end());
+	double total = 0;
+	for(double m : ms)
+		total += m;
+	auto percentile = [&](double p) { return ms[std::min(ms.size() - 1, (size_t)(p * ms.size()))]; };
+	printf("%-12s min %7.3f  mean %7.3f  p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f ms\n", name, ms.front(), total / ms.size(), percentile(0.5), percentile(0.95), percentile(0.99), ms.back());
+}
+
+#endif
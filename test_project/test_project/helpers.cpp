@@ -4,45 +4,451 @@
 #include<glm/glm.hpp>
 #include<glm/gtc/matrix_transform.hpp>
 #include<glm/gtc/type_ptr.hpp>
-#include <glm/gtx/hash.hpp>
 #include <algorithm>
-#include <unordered_map>
 #include <vector>
+#include <string>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "scolor.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "game.h"
+#include "mesh_tools.h"
 #include "tiny_obj_loader.h"
 
+/* Next mip level down:  each texel is the average of the (up to) 2x2 above it */
+static image_level box_filter(const image_level& src){
+	image_level dst;
+	dst.width = src.width > 1 ? src.width / 2 : 1;
+	dst.height = src.height > 1 ? src.height / 2 : 1;
+	dst.data.resize((size_t)dst.width * dst.height * 3);
+	for(int y = 0; y < dst.height; y++){
+		int y0 = std::min(2*y, src.height - 1), y1 = std::min(2*y + 1, src.height - 1);
+		const unsigned char* r0 = &src.data[(size_t)y0 * src.width * 3];
+		const unsigned char* r1 = &src.data[(size_t)y1 * src.width * 3];
+		unsigned char* out = &dst.data[(size_t)y * dst.width * 3];
+		for(int x = 0; x < dst.width; x++){
+			int x0 = std::min(2*x, src.width - 1) * 3, x1 = std::min(2*x + 1, src.width - 1) * 3;
+			for(int c = 0; c < 3; c++)
+				out[3*x + c] = (r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) / 4;
+		}
+	}
+	return dst;
+}
+
+static uint16_t rgb565(const int* c){
+	return ((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255);
+}
+static void unpack565(uint16_t v, int* c){
+	c[0] = (v >> 11) * 255 / 31;
+	c[1] = ((v >> 5) & 63) * 255 / 63;
+	c[2] = (v & 31) * 255 / 31;
+}
 
-namespace std {
-	template<> struct hash<vertex> {
-		size_t operator()(vertex const& v) const {
-			return hash<glm::vec3>()(v.pos) ^ (hash<glm::vec2>()(v.tex_coord) << 1);
+/* One 4x4 block of RGB texels to BC1.  Endpoints are the corners of the block's colour
+ * bounding box, along whichever diagonal follows the colours, then each texel takes the
+ * nearest of the four palette entries.
+ */
+static void encode_bc1_block(const unsigned char texels[16][3], unsigned char* out){
+	int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0}, mean[3] = {0, 0, 0};
+	for(int i = 0; i < 16; i++)
+		for(int c = 0; c < 3; c++){
+			lo[c] = std::min(lo[c], (int)texels[i][c]);
+			hi[c] = std::max(hi[c], (int)texels[i][c]);
+			mean[c] += texels[i][c];
 		}
-	};
+	// Flip green and blue if they run against red
+	int cov_g = 0, cov_b = 0;
+	for(int i = 0; i < 16; i++){
+		int r = texels[i][0] * 16 - mean[0];
+		cov_g += r * (texels[i][1] * 16 - mean[1]) / 256;
+		cov_b += r * (texels[i][2] * 16 - mean[2]) / 256;
+	}
+	if(cov_g < 0)
+		std::swap(lo[1], hi[1]);
+	if(cov_b < 0)
+		std::swap(lo[2], hi[2]);
+
+	uint16_t c0 = rgb565(hi), c1 = rgb565(lo);
+	if(c0 < c1)
+		std::swap(c0, c1);
+	uint32_t selectors = 0;
+	if(c0 != c1){	// c0 == c1 is all index 0
+		int palette[4][3];
+		unpack565(c0, palette[0]);
+		unpack565(c1, palette[1]);
+		for(int c = 0; c < 3; c++){
+			palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+		}
+		for(int i = 0; i < 16; i++){
+			int best = 0, best_distance = 1 << 30;
+			for(int p = 0; p < 4; p++){
+				int dr = texels[i][0] - palette[p][0], dg = texels[i][1] - palette[p][1], db = texels[i][2] - palette[p][2];
+				int distance = dr*dr + dg*dg + db*db;
+				if(distance < best_distance){
+					best_distance = distance;
+					best = p;
+				}
+			}
+			selectors |= best << (2*i);
+		}
+	}
+	out[0] = c0 & 0xff; out[1] = c0 >> 8;
+	out[2] = c1 & 0xff; out[3] = c1 >> 8;
+	for(int i = 0; i < 4; i++)
+		out[4 + i] = selectors >> (8*i);
+}
+
+static size_t bc1_size(int width, int height){
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+static image_level encode_bc1(const image_level& src){
+	image_level dst;
+	dst.width = src.width;
+	dst.height = src.height;
+	dst.data.resize(bc1_size(src.width, src.height));
+	unsigned char* out = dst.data.data();
+	for(int by = 0; by < src.height; by += 4)
+		for(int bx = 0; bx < src.width; bx += 4){
+			unsigned char texels[16][3];
+			for(int i = 0; i < 16; i++){	// Edges repeat the last row/column
+				int x = std::min(bx + i % 4, src.width - 1), y = std::min(by + i / 4, src.height - 1);
+				memcpy(texels[i], &src.data[((size_t)y * src.width + x) * 3], 3);
+			}
+			encode_bc1_block(texels, out);
+			out += 8;
+		}
+	return dst;
+}
+
+/* Compressed texture cache
+ * BC1 encoding the whole chain costs more than decoding the JPEG, so it's saved as
+ * <file>.bc1cache:  a header, then every level's blocks, largest first.  Like the mesh cache it
+ * only counts while the source's mtime and size match.
+ */
+#define TEXTURE_CACHE_MAGIC 0x31434247 // "GBC1"
+#define TEXTURE_CACHE_VERSION 1
+#define TEXTURE_CACHE_MAX_SIZE 16384	// Anything bigger is a corrupt header
+
+struct texture_cache_header {
+	uint32_t magic, version;
+	int64_t source_mtime;
+	uint64_t source_size;
+	int32_t width, height;
+	uint32_t level_count;
+};
+
+/* Levels in a chain halved down to 1 by 1, as decode_texture builds it */
+static uint32_t full_chain_levels(int width, int height){
+	uint32_t levels = 1;
+	for(int size = std::max(width, height); size > 1; size /= 2)
+		levels++;
+	return levels;
+}
+
+static bool read_texture_cache(image_data& image, const std::string& path, const struct stat& source){
+	FILE* fd = fopen(path.c_str(), "rb");
+	if(!fd)
+		return false;
+	texture_cache_header h;
+	bool ok = fread(&h, sizeof(h), 1, fd) == 1 &&
+		h.magic == TEXTURE_CACHE_MAGIC && h.version == TEXTURE_CACHE_VERSION &&
+		h.source_mtime == (int64_t)source.st_mtime && h.source_size == (uint64_t)source.st_size &&
+		h.width > 0 && h.height > 0 && h.width <= TEXTURE_CACHE_MAX_SIZE && h.height <= TEXTURE_CACHE_MAX_SIZE &&
+		h.level_count == full_chain_levels(h.width, h.height);
+	int width = h.width, height = h.height;
+	for(uint32_t i = 0; ok && i < h.level_count; i++){
+		image_level level;
+		level.width = width;
+		level.height = height;
+		level.data.resize(bc1_size(width, height));
+		ok = fread(level.data.data(), 1, level.data.size(), fd) == level.data.size();
+		image.levels.push_back(std::move(level));
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	fclose(fd);
+	if(!ok){
+		image.levels.clear();
+		return false;
+	}
+	image.width = h.width;
+	image.height = h.height;
+	image.bc1 = true;
+	return true;
+}
+
+static void write_texture_cache(const image_data& image, const std::string& path, const struct stat& source){
+	texture_cache_header h = {};
+	h.magic = TEXTURE_CACHE_MAGIC;
+	h.version = TEXTURE_CACHE_VERSION;
+	h.source_mtime = source.st_mtime;
+	h.source_size = source.st_size;
+	h.width = image.width;
+	h.height = image.height;
+	h.level_count = image.levels.size();
+	std::string tmp = path + ".tmp";
+	FILE* fd = fopen(tmp.c_str(), "wb");
+	if(!fd){
+		printf("Couldn't write texture cache %s\n", path.c_str());
+		return;
+	}
+	bool ok = fwrite(&h, sizeof(h), 1, fd) == 1;
+	for(const image_level& level : image.levels)
+		ok = ok && fwrite(level.data.data(), 1, level.data.size(), fd) == level.data.size();
+	ok = !fclose(fd) && ok;
+#ifdef _WIN32
+	remove(path.c_str()); // Windows won't rename over an existing file
+#endif
+	if(!ok || rename(tmp.c_str(), path.c_str())){
+		remove(tmp.c_str());
+		printf("Couldn't write texture cache %s\n", path.c_str());
+	}
 }
 
-unsigned int load_texture(const char* filename){
-	int width, height, channels;
-	unsigned char *image_data = stbi_load(filename, &width, &height, &channels, 3);
-	if(image_data){
-		printf("Loaded image, %d by %d\n", width, height);
-		unsigned int tex;
-		glGenTextures(1, &tex);
-		glBindTexture(GL_TEXTURE_2D, tex);
-		// If you want to set parameters, call glTexParameteri (or similar)
- 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image_data);
-		free(image_data);
-		return tex;
-	} else {
+/* CPU side, safe to call from worker threads.  Decodes and builds the full mip chain, as RGB or
+ * as BC1 blocks if bc1 is set (those come from the cache when it's up to date).
+ */
+bool decode_texture(const char* filename, image_data& image, bool bc1){
+	struct stat source;
+	std::string cache_path = std::string(filename) + ".bc1cache";
+	bool have_source = !stat(filename, &source);
+	if(bc1 && have_source && read_texture_cache(image, cache_path, source)){
+		printf("Loaded image %s from texture cache, %d by %d\n", filename, image.width, image.height);
+		return true;
+	}
+
+	int channels;
+	unsigned char* pixels = stbi_load(filename, &image.width, &image.height, &channels, 3);
+	if(!pixels){
 		printf(RED("Image failed to load:  %s\n").c_str(), filename);
+		return false;
+	}
+	printf("Loaded image, %d by %d\n", image.width, image.height);
+	image_level top;
+	top.width = image.width;
+	top.height = image.height;
+	top.data.assign(pixels, pixels + (size_t)image.width * image.height * 3);
+	stbi_image_free(pixels);
+
+	image.levels.clear();
+	image.levels.push_back(std::move(top));
+	while(image.levels.back().width > 1 || image.levels.back().height > 1)
+		image.levels.push_back(box_filter(image.levels.back()));
+
+	if(bc1){
+		for(image_level& level : image.levels)
+			level = encode_bc1(level);
+		image.bc1 = true;
+		if(have_source)
+			write_texture_cache(image, cache_path, source);
+	}
+	return true;
+}
+
+/* GL thread only.  Immutable storage for the whole chain, trilinear and anisotropic filtering. */
+unsigned int upload_texture(const image_data& image){
+	unsigned int tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	GLenum format = image.bc1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8;
+	glTexStorage2D(GL_TEXTURE_2D, image.levels.size(), format, image.width, image.height);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB rows aren't padded to 4 bytes
+	for(size_t i = 0; i < image.levels.size(); i++){
+		const image_level& level = image.levels[i];
+		if(image.bc1)
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, level.width, level.height, format, level.data.size(), level.data.data());
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, level.width, level.height, GL_RGB, GL_UNSIGNED_BYTE, level.data.data());
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if(GLEW_EXT_texture_filter_anisotropic){
+		float max_anisotropy = 1.0f;
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_anisotropy);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, std::min(max_anisotropy, MAX_ANISOTROPY));
+	}
+	return tex;
+}
+
+unsigned int load_texture(const char* filename, bool bc1){
+	image_data image;
+	if(!decode_texture(filename, image, bc1))
 		return 0;
+	return upload_texture(image);
+}
+
+/* Compiled mesh cache
+ * Parsing OBJ text and deduplicating is slow, so the result is saved next to the source as
+ * <file>.<scale>.<swap_yz>.meshcache:  a header (with the LOD ranges), the vertex array, then
+ * the indices of every LOD.  It's only
+ * used while the source's mtime and size match what the header recorded.
+ */
+#define MESH_CACHE_MAGIC 0x48534d47 // "GMSH"
+#define MESH_CACHE_VERSION 3 // 2:  vertex cache optimised, 3:  LODs
+
+struct mesh_cache_header {
+	uint32_t magic, version;
+	int64_t source_mtime;
+	uint64_t source_size;
+	float scale;
+	uint32_t swap_yz;
+	uint32_t vertex_count, index_count;
+	uint32_t lod_count;
+	mesh_lod lods[MAX_LODS];
+};
+
+static std::string mesh_cache_path(const char* filename, float scale, bool swap_yz) {
+	uint32_t scale_bits;
+	memcpy(&scale_bits, &scale, sizeof(scale_bits));
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%08x.%d.meshcache", scale_bits, swap_yz ? 1 : 0);
+	return std::string(filename) + suffix;
+}
+
+/* The LODs have to sit back to back from index 0 and use up exactly the indices there are,
+ * full detail first, or the draws would read past the index buffer
+ */
+static bool mesh_cache_lods_valid(const mesh_cache_header& h) {
+	if(h.lod_count < 1 || h.lod_count > MAX_LODS)
+		return false;
+	uint64_t end = 0;
+	for(uint32_t k = 0; k < h.lod_count; k++) {
+		if(h.lods[k].first_index != end || h.lods[k].index_count % 3)
+			return false;
+		end += h.lods[k].index_count;
+	}
+	return end == h.index_count;
+}
+
+static bool mesh_cache_valid(const mesh_cache_header& h, const struct stat& source, float scale, bool swap_yz, size_t file_size) {
+	return	h.magic == MESH_CACHE_MAGIC && h.version == MESH_CACHE_VERSION &&
+		h.source_mtime == (int64_t)source.st_mtime && h.source_size == (uint64_t)source.st_size &&
+		h.scale == scale && h.swap_yz == (swap_yz ? 1u : 0u) &&
+		mesh_cache_lods_valid(h) &&
+		file_size == sizeof(h) + h.vertex_count * sizeof(vertex) + h.index_count * sizeof(uint32_t);
+}
+
+/* Maps the cache and copies it out.  Returns false if there's no usable cache. */
+static bool read_mesh_cache(std::vector<vertex>& vertices, std::vector<uint32_t>& indices, std::vector<mesh_lod>& lods, const std::string& path, const struct stat& source, float scale, bool swap_yz) {
+#ifndef _WIN32
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat cache_stat;
+	if(fstat(fd, &cache_stat) || (size_t)cache_stat.st_size < sizeof(mesh_cache_header)) {
+		close(fd);
+		return false;
+	}
+	size_t file_size = cache_stat.st_size;
+	void* mapping = mmap(0, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED)
+		return false;
+	const char* data = (const char*)mapping;
+#else
+	FILE* fd = fopen(path.c_str(), "rb");
+	if(!fd)
+		return false;
+	std::vector<char> contents;
+	char chunk[65536];
+	size_t got;
+	while((got = fread(chunk, 1, sizeof(chunk), fd)) > 0)
+		contents.insert(contents.end(), chunk, chunk + got);
+	fclose(fd);
+	size_t file_size = contents.size();
+	if(file_size < sizeof(mesh_cache_header))
+		return false;
+	const char* data = contents.data();
+#endif
+	mesh_cache_header h;
+	memcpy(&h, data, sizeof(h));
+	bool valid = mesh_cache_valid(h, source, scale, swap_yz, file_size);
+	if(valid) {
+		const char* vertex_data = data + sizeof(h);
+		const char* index_data = vertex_data + h.vertex_count * sizeof(vertex);
+		vertices.resize(h.vertex_count);
+		indices.resize(h.index_count);
+		memcpy(vertices.data(), vertex_data, h.vertex_count * sizeof(vertex));
+		memcpy(indices.data(), index_data, h.index_count * sizeof(uint32_t));
+		lods.assign(h.lods, h.lods + h.lod_count);
+		// Or every draw of it would read past the vertex buffer
+		for(uint32_t i : indices)
+			if(i >= h.vertex_count) {
+				valid = false;
+				break;
+			}
+		if(!valid) {
+			vertices.clear();
+			indices.clear();
+			lods.clear();
+		}
+	}
+#ifndef _WIN32
+	munmap(mapping, file_size);
+#endif
+	return valid;
+}
+
+/* Written to a temporary name and renamed, so a half written cache is never picked up */
+static void write_mesh_cache(const std::vector<vertex>& vertices, const std::vector<uint32_t>& indices, const std::vector<mesh_lod>& lods, const std::string& path, const struct stat& source, float scale, bool swap_yz) {
+	mesh_cache_header h = {};
+	h.magic = MESH_CACHE_MAGIC;
+	h.version = MESH_CACHE_VERSION;
+	h.source_mtime = source.st_mtime;
+	h.source_size = source.st_size;
+	h.scale = scale;
+	h.swap_yz = swap_yz;
+	h.vertex_count = vertices.size();
+	h.index_count = indices.size();
+	h.lod_count = lods.size();
+	memcpy(h.lods, lods.data(), lods.size() * sizeof(mesh_lod));
+	std::string tmp = path + ".tmp";
+	FILE* fd = fopen(tmp.c_str(), "wb");
+	if(!fd) {
+		printf("Couldn't write mesh cache %s\n", path.c_str());
+		return;
 	}
+	bool ok = fwrite(&h, sizeof(h), 1, fd) == 1;
+	ok = ok && fwrite(vertices.data(), sizeof(vertex), vertices.size(), fd) == vertices.size();
+	ok = ok && fwrite(indices.data(), sizeof(uint32_t), indices.size(), fd) == indices.size();
+	ok = !fclose(fd) && ok;
+#ifdef _WIN32
+	remove(path.c_str()); // Windows won't rename over an existing file
+#endif
+	if(!ok || rename(tmp.c_str(), path.c_str())) {
+		remove(tmp.c_str());
+		printf("Couldn't write mesh cache %s\n", path.c_str());
+	}
+}
+
+/* The cache always has every LOD, callers that don't want them just get the first */
+static void keep_lods(std::vector<uint32_t>& indices, std::vector<mesh_lod>& all_lods, std::vector<mesh_lod>* lods) {
+	if(lods)
+		lods->swap(all_lods);
+	else
+		indices.resize(all_lods[0].index_count);
 }
 
-int load_model(std::vector<vertex> &vertices, std::vector<uint32_t> &indices, const char *filename, float scale, bool swap_yz){
+int load_model(std::vector<vertex> &vertices, std::vector<uint32_t> &indices, const char *filename, float scale, bool swap_yz, job_system* jobs, std::vector<mesh_lod>* lods){
+	struct stat source;
+	std::string cache_path = mesh_cache_path(filename, scale, swap_yz);
+	bool have_source = !stat(filename, &source);
+	std::vector<mesh_lod> all_lods;
+	if(have_source && read_mesh_cache(vertices, indices, all_lods, cache_path, source, scale, swap_yz)) {
+		printf("Loaded %s from mesh cache (%zu vertices, %zu indices in %zu LODs)\n", filename, vertices.size(), indices.size(), all_lods.size());
+		keep_lods(indices, all_lods, lods);
+		return 0;
+	}
+
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -52,35 +458,182 @@ int load_model(std::vector<vertex> &vertices, std::vector<uint32_t> &indices, co
 		return 1;
 	}
 
-	std::unordered_map<vertex, uint32_t> uniqueVertices = {};
+	std::vector<size_t> shape_sizes;
+	for (const auto& shape : shapes)
+		shape_sizes.push_back(shape.mesh.indices.size());
+	auto corner = [&](size_t s, size_t i) {
+		const tinyobj::index_t& index = shapes[s].mesh.indices[i];
+		vertex new_vertex = {};
+		new_vertex.pos = {
+			attrib.vertices[3 * index.vertex_index + 0],
+			attrib.vertices[3 * index.vertex_index + 1],
+			attrib.vertices[3 * index.vertex_index + 2]
 
-	for (const auto& shape : shapes) {
-		for (const auto& index : shape.mesh.indices) {
-			vertex new_vertex = {};
-			new_vertex.pos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
+		};
+		/* Transform vertices if we need to */
+		new_vertex.pos *= scale;
+		if (swap_yz) {
+			float tmp = new_vertex.pos.y;
+			new_vertex.pos.y = new_vertex.pos.z;
+			new_vertex.pos.z = tmp;
+		}
 
-			};
-			/* Transform vertices if we need to */
-			new_vertex.pos *= scale;
-			if (swap_yz) {
-				float tmp = new_vertex.pos.y;
-				new_vertex.pos.y = new_vertex.pos.z;
-				new_vertex.pos.z = tmp;
-			}
+		new_vertex.tex_coord = {
+			attrib.texcoords[2 * index.texcoord_index + 0],
+			1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+		};
+		return new_vertex;
+	};
+	if (jobs)
+		dedup_vertices_parallel(*jobs, shape_sizes, corner, vertices, indices);
+	else
+		dedup_vertices(shape_sizes, corner, vertices, indices);
 
-			new_vertex.tex_coord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
-			if (uniqueVertices.count(new_vertex) == 0) {
-				uniqueVertices[new_vertex] = (uint32_t)vertices.size();
-				vertices.push_back(new_vertex);
-			}
-			indices.push_back(uniqueVertices[new_vertex]);
+	/* Fewer vertex shader runs per triangle, which every instance pays for */
+	float acmr_before = acmr(indices, vertices.size());
+	optimize_vertex_cache(indices, vertices.size());
+	float acmr_after = acmr(indices, vertices.size());
+	size_t full_count = indices.size();
+
+	/* Simplified copies for drawing far away, then fetch order for the lot (LOD 0 uses every vertex, so it decides) */
+	build_lods(vertices, indices, all_lods);
+	optimize_vertex_fetch(vertices, indices);
+	printf("Loaded %s (%zu vertices, %zu indices), ACMR %.3f -> %.3f\n", filename, vertices.size(), full_count, acmr_before, acmr_after);
+	for(size_t i = 1; i < all_lods.size(); i++)
+		printf("  LOD %zu:  %u triangles, error %g\n", i, all_lods[i].index_count / 3, all_lods[i].error);
+
+	if(have_source)
+		write_mesh_cache(vertices, indices, all_lods, cache_path, source, scale, swap_yz);
+	keep_lods(indices, all_lods, lods);
+	return 0;
+}
+
+/* Program binary cache
+ * Compiling and linking every shader is most of a cold start, so linked programs are saved with
+ * glGetProgramBinary as <path given>, a header and then the driver's blob.  It only counts while
+ * the hash of the shader sources and of the driver match, and the driver gets the last word:
+ * if it won't take the binary back, the caller compiles from source as usual.
+ */
+#define PROGRAM_CACHE_MAGIC 0x47525047 // "GPRG"
+#define PROGRAM_CACHE_VERSION 1
+
+struct program_cache_header {
+	uint32_t magic, version;
+	uint64_t source_hash, driver_hash;
+	uint32_t format, length;
+};
+
+static uint64_t fnv1a(const void* data, size_t size, uint64_t h = 0xcbf29ce484222325ull){
+	const unsigned char* p = (const unsigned char*)data;
+	for(size_t i = 0; i < size; i++)
+		h = (h ^ p[i]) * 0x100000001b3ull;
+	return h;
+}
+
+/* Binaries are only good for the driver that made them */
+static uint64_t driver_hash(){
+	uint64_t h = fnv1a(0, 0);
+	for(GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION}){
+		const char* s = (const char*)glGetString(name);
+		if(s)
+			h = fnv1a(s, strlen(s) + 1, h);
+	}
+	return h;
+}
+
+bool hash_files(const char* const* files, int count, uint64_t& hash){
+	hash = fnv1a(0, 0);
+	std::vector<char> contents;
+	for(int i = 0; i < count; i++){
+		hash = fnv1a(&i, sizeof(i), hash); // So a file moving to another stage counts as a change
+		if(!files[i])
+			continue;
+		FILE* fd = fopen(files[i], "rb");
+		if(!fd){
+			printf("File not found:  %s\n", files[i]);
+			return false;
 		}
+		fseek(fd, 0, SEEK_END);
+		long size = ftell(fd);
+		fseek(fd, 0, SEEK_SET);
+		contents.resize(size > 0 ? size : 0);
+		bool ok = size >= 0 && fread(contents.data(), 1, contents.size(), fd) == contents.size();
+		fclose(fd);
+		if(!ok)
+			return false;
+		hash = fnv1a(contents.data(), contents.size(), hash);
+	}
+	return true;
+}
+
+unsigned int load_program_binary(const char* path, uint64_t source_hash){
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if(!formats)
+		return 0;
+	FILE* fd = fopen(path, "rb");
+	if(!fd)
+		return 0;
+	program_cache_header h;
+	std::vector<char> binary;
+	bool ok = fread(&h, sizeof(h), 1, fd) == 1 &&
+		h.magic == PROGRAM_CACHE_MAGIC && h.version == PROGRAM_CACHE_VERSION &&
+		h.source_hash == source_hash && h.driver_hash == driver_hash() && h.length;
+	if(ok){
+		binary.resize(h.length);
+		ok = fread(binary.data(), 1, binary.size(), fd) == binary.size();
+	}
+	fclose(fd);
+	if(!ok)
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, h.format, binary.data(), binary.size());
+	GLint link_ok = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+	if(!link_ok){
+		printf("Driver rejected program binary %s, compiling instead\n", path);
+		glDeleteProgram(program);
+		return 0;
+	}
+	printf("Loaded program from %s\n", path);
+	return program;
+}
+
+/* program has to have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.  Written to a
+ * temporary name and renamed, like the other caches.
+ */
+void save_program_binary(unsigned int program, const char* path, uint64_t source_hash){
+	GLint formats = 0, length = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(!formats || length <= 0)
+		return;
+	program_cache_header h = {};
+	h.magic = PROGRAM_CACHE_MAGIC;
+	h.version = PROGRAM_CACHE_VERSION;
+	h.source_hash = source_hash;
+	h.driver_hash = driver_hash();
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+	if(length <= 0)
+		return;
+	h.format = format;
+	h.length = length;
+	std::string tmp = std::string(path) + ".tmp";
+	FILE* fd = fopen(tmp.c_str(), "wb");
+	if(!fd){
+		printf("Couldn't write program cache %s\n", path);
+		return;
+	}
+	bool ok = fwrite(&h, sizeof(h), 1, fd) == 1 && fwrite(binary.data(), 1, h.length, fd) == h.length;
+	ok = !fclose(fd) && ok;
+#ifdef _WIN32
+	remove(path); // Windows won't rename over an existing file
+#endif
+	if(!ok || rename(tmp.c_str(), path)){
+		remove(tmp.c_str());
+		printf("Couldn't write program cache %s\n", path);
 	}
-	return 0;
 }
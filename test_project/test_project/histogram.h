@@ -0,0 +1,116 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include<stdio.h>
+#include<stdint.h>
+#include<string.h>
+#include<chrono>
+
+/* Log-linear histogram of durations in nanoseconds, in the style of HdrHistogram.
+ * Values under HISTOGRAM_SUB_BUCKETS ns are counted exactly;  above that every power of two is
+ * split into HISTOGRAM_SUB_BUCKETS / 2 buckets, so any value is within 1/64 (1.6%) of where it
+ * was counted, from a nanosecond up to about 36 minutes.  Anything longer lands in the last bucket.
+ * Recording is a few instructions and never allocates, so it's fine in a tick or frame loop.
+ * Not thread safe:  one thread records, and reads once it's done or from that same thread.
+ * Percentiles are where the tail is, which averages hide:  one 5 ms hitch in a thousand 1 ms
+ * ticks barely moves the mean, but it's the p99.9 and the max.
+ */
+#define HISTOGRAM_SUB_BUCKETS 128
+#define HISTOGRAM_MAX_SHIFT 34
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + HISTOGRAM_MAX_SHIFT * HISTOGRAM_SUB_BUCKETS / 2)
+
+class hdr_histogram {
+	public:
+		void record(uint64_t ns) {
+			counts[bucket_of(ns)]++;
+			total++;
+			sum += ns;
+			if(ns > largest)
+				largest = ns;
+		}
+		template<typename Rep, typename Period>
+		void record(std::chrono::duration<Rep, Period> d) {
+			record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+		}
+
+		uint64_t count() const { return total; }
+		uint64_t max() const { return largest; }
+		double mean() const { return total ? (double)sum / total : 0; }
+
+		/* The value a fraction p (0 to 1) of everything recorded is no larger than, to the
+		 * resolution of its bucket
+		 */
+		uint64_t percentile(double p) const {
+			if(!total)
+				return 0;
+			uint64_t wanted = (uint64_t)(p * total + 0.5);
+			if(wanted < 1)
+				wanted = 1;
+			uint64_t seen = 0;
+			for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+				seen += counts[i];
+				if(seen >= wanted) {
+					uint64_t v = highest_in(i);
+					return v < largest ? v : largest;
+				}
+			}
+			return largest;
+		}
+
+		void reset() {
+			memset(counts, 0, sizeof(counts));
+			total = sum = largest = 0;
+		}
+
+		void print(const char* name) const {
+			printf("  %-20s %8llu   mean %8.3f  p50 %8.3f  p95 %8.3f  p99 %8.3f  max %8.3f ms\n", name, (unsigned long long)total,
+				mean() / 1e6, percentile(0.5) / 1e6, percentile(0.95) / 1e6, percentile(0.99) / 1e6, largest / 1e6);
+		}
+
+		/* One line under csv_header */
+		static void csv_header(FILE* f) {
+			fputs("name,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n", f);
+		}
+		void csv_row(FILE* f, const char* name) const {
+			fprintf(f, "%s,%llu,%.6f,%.6f,%.6f,%.6f,%.6f\n", name, (unsigned long long)total,
+				mean() / 1e6, percentile(0.5) / 1e6, percentile(0.95) / 1e6, percentile(0.99) / 1e6, largest / 1e6);
+		}
+
+	private:
+		uint64_t counts[HISTOGRAM_BUCKETS] = {};
+		uint64_t total = 0, sum = 0, largest = 0;
+
+		static int bit_length(uint64_t v) {
+#if defined(__GNUC__)
+			return v ? 64 - __builtin_clzll(v) : 0;
+#else
+			int n = 0;
+			for(; v; v >>= 1)
+				n++;
+			return n;
+#endif
+		}
+
+		/* Below SUB_BUCKETS, v itself.  Above, shift is how far v has to move right to land in
+		 * [SUB_BUCKETS / 2, SUB_BUCKETS), and that's the bucket within the power of two.
+		 */
+		static int bucket_of(uint64_t v) {
+			const int half = HISTOGRAM_SUB_BUCKETS / 2;
+			if(v < HISTOGRAM_SUB_BUCKETS)
+				return (int)v;
+			int shift = bit_length(v) - bit_length(HISTOGRAM_SUB_BUCKETS - 1);
+			if(shift > HISTOGRAM_MAX_SHIFT)
+				return HISTOGRAM_BUCKETS - 1;
+			return HISTOGRAM_SUB_BUCKETS + (shift - 1) * half + (int)((v >> shift) - half);
+		}
+		static uint64_t highest_in(int bucket) {
+			const int half = HISTOGRAM_SUB_BUCKETS / 2;
+			if(bucket < HISTOGRAM_SUB_BUCKETS)
+				return bucket;
+			int shift = (bucket - HISTOGRAM_SUB_BUCKETS) / half + 1;
+			uint64_t sub = (bucket - HISTOGRAM_SUB_BUCKETS) % half + half;
+			return ((sub + 1) << shift) - 1;
+		}
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef INSTANCE_HANDLES_H
+#define INSTANCE_HANDLES_H
+
+#include<vector>
+#include<cstdint>
+#include<cstddef>
+
+#define NO_INSTANCE 0xffffffffu
+
+/* Remove element i of a dense array by moving the last element into its place */
+template<typename T>
+void swap_pop(std::vector<T>& v, size_t i) {
+	if(i + 1 != v.size())
+		v[i] = v.back();
+	v.pop_back();
+}
+
+/* Stable handles for instances kept in dense arrays.
+ * Objects store their per-instance data packed (locations, directions, ...) and remove with
+ * swap_pop, which is O(1) but moves the last instance.  Anything that has to keep pointing at
+ * one instance across removals holds a handle instead of an index.
+ * The low 24 bits of a handle pick a slot, the high 8 bits are a generation, so a handle to a
+ * removed instance stops resolving even after its slot gets reused.
+ */
+class instance_handles {
+	public:
+		/* For an instance just appended to the dense arrays */
+		uint32_t add() {
+			uint32_t slot;
+			if(free_slots.empty()) {
+				slot = slots.size();
+				slots.push_back(0);
+				generations.push_back(0);
+			} else {
+				slot = free_slots.back();
+				free_slots.pop_back();
+			}
+			slots[slot] = dense.size();
+			dense.push_back(slot);
+			return slot | (generations[slot] << 24);
+		}
+
+		/* Call alongside swap_pop on the dense arrays */
+		void remove(size_t index) {
+			uint32_t slot = dense[index];
+			generations[slot] = (generations[slot] + 1) & 0xff;
+			slots[slot] = NO_INSTANCE;
+			free_slots.push_back(slot);
+			if(index + 1 != dense.size()) {
+				dense[index] = dense.back();
+				slots[dense[index]] = index;
+			}
+			dense.pop_back();
+		}
+
+		/* Dense index, or NO_INSTANCE if the handle's instance is gone */
+		uint32_t index_of(uint32_t handle) const {
+			uint32_t slot = handle & 0xffffff;
+			if(slot >= slots.size() || generations[slot] != handle >> 24)
+				return NO_INSTANCE;
+			return slots[slot];
+		}
+
+		uint32_t handle_of(size_t index) const {
+			uint32_t slot = dense[index];
+			return slot | (generations[slot] << 24);
+		}
+
+		size_t size() const { return dense.size(); }
+
+	private:
+		std::vector<uint32_t> slots;		// slot -> dense index
+		std::vector<uint32_t> generations;	// slot -> generation
+		std::vector<uint32_t> dense;		// dense index -> slot
+		std::vector<uint32_t> free_slots;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef INSTANCE_RING_H
+#define INSTANCE_RING_H
+
+#include<GL/glew.h>
+#include<stdio.h>
+
+#define RING_SECTIONS 3
+
+/* Persistently mapped, triple buffered storage for per-instance data.
+ * Each frame gets its own section of one immutable buffer:  draw() writes straight into the
+ * mapping, binds that section and fences it.  Before a section is reused three frames later we
+ * wait on its fence, which in practice has long since signaled.
+ * Must only be used from the GL thread.
+ */
+class instance_ring {
+	public:
+		GLuint buffer = 0;
+		char* mapped = 0;
+		size_t section_size = 0;
+		int current = 0;
+		size_t used = 0;
+		GLsync fences[RING_SECTIONS] = {};
+
+		/* Space for bytes of instance data in this frame's section */
+		void* begin(size_t bytes) {
+			if(bytes > section_size)
+				grow(bytes);
+			if(!mapped)
+				return 0;
+			wait(current);
+			used = bytes;
+			return mapped + current * section_size;
+		}
+
+		/* Bind what begin() handed out to an SSBO binding point */
+		void bind(GLuint binding) {
+			glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, current * section_size, used);
+		}
+
+		/* Where this frame's section starts in buffer, for binding parts of it */
+		size_t section_offset() const { return current * section_size; }
+
+		/* Call after the draw that reads this section has been issued */
+		void finish() {
+			fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			current = (current + 1) % RING_SECTIONS;
+		}
+
+		void destroy() {
+			for(int i = 0; i < RING_SECTIONS; i++)
+				wait(i);
+			if(buffer) {
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+				glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+				glDeleteBuffers(1, &buffer);
+			}
+			buffer = 0;
+			mapped = 0;
+			section_size = 0;
+		}
+
+	private:
+		void wait(int section) {
+			if(!fences[section])
+				return;
+			GLenum status;
+			do {
+				status = glClientWaitSync(fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while(status == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fences[section]);
+			fences[section] = 0;
+		}
+
+		/* Storage is immutable, so growing means a new buffer.  Double so bursts don't regrow every frame. */
+		void grow(size_t bytes) {
+			GLint align = 256;
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
+			size_t new_size = section_size ? section_size : 4096;
+			while(new_size < bytes)
+				new_size *= 2;
+			new_size = (new_size + align - 1) / align * align;
+
+			destroy();
+			section_size = new_size;
+			current = 0;
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+			glBufferStorage(GL_SHADER_STORAGE_BUFFER, section_size * RING_SECTIONS, 0, flags);
+			mapped = (char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, section_size * RING_SECTIONS, flags);
+			if(!mapped)
+				puts("Instance ring:  persistent map failed");
+		}
+};
+
+#endif
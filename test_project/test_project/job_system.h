@@ -0,0 +1,163 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include<vector>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<atomic>
+#include<functional>
+#include "profiler.h"
+
+/* Default parallel_for chunk size for per-instance loops */
+#define JOB_GRAIN 4096
+
+/* Jobs that can be waited on together */
+struct job_group {
+	std::atomic<int> pending{0};
+};
+
+/* Work-stealing thread pool.
+ * Every worker has its own deque.  It pops its own work from the back (most recently pushed,
+ * still warm in cache) and when that runs dry steals from the front of someone else's.
+ * Threads that aren't workers (the simulation thread) push round-robin, and run jobs
+ * themselves while they wait, so a pool of N workers spawns N-1 threads.
+ * With one worker nothing is spawned and everything runs inline on the caller.
+ */
+class job_system {
+	public:
+		~job_system() { stop(); }
+
+		/* 0 means one worker per hardware thread */
+		void start(unsigned workers = 0) {
+			stop();
+			if(!workers)
+				workers = std::thread::hardware_concurrency();
+			if(!workers)
+				workers = 1;
+			queues = std::vector<job_queue>(workers);
+			stopping = false;
+			for(unsigned i = 1; i < workers; i++)
+				threads.push_back(std::thread(&job_system::worker_loop, this, i));
+		}
+
+		void stop() {
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for(std::thread& t : threads)
+				t.join();
+			threads.clear();
+		}
+
+		unsigned worker_count() const { return queues.size() ? queues.size() : 1; }
+
+		void run(job_group& group, std::function<void()> job) {
+			group.pending++;
+			if(worker_count() == 1) {
+				job();
+				group.pending--;
+				return;
+			}
+			std::function<void()> wrapped = [&group, job]() {
+				job();
+				group.pending--;
+			};
+			int q = worker_index >= 0 && worker_index < (int)queues.size() ? worker_index : next_queue++ % queues.size();
+			{
+				std::lock_guard<std::mutex> lock(queues[q].mutex);
+				queues[q].jobs.push_back(wrapped);
+			}
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				queued++;
+			}
+			wake.notify_one();
+		}
+
+		/* Helps out with queued jobs until everything in group is done */
+		void wait(job_group& group) {
+			while(group.pending) {
+				if(!run_one())
+					std::this_thread::yield();
+			}
+		}
+
+		/* Calls fn(begin, end) over chunks of at most grain items and waits for all of them */
+		template<typename F>
+		void parallel_for(size_t begin, size_t end, size_t grain, F fn) {
+			if(end <= begin)
+				return;
+			if(worker_count() == 1 || end - begin <= grain) {
+				fn(begin, end);
+				return;
+			}
+			job_group group;
+			for(size_t lo = begin; lo < end; lo += grain) {
+				size_t hi = lo + grain < end ? lo + grain : end;
+				run(group, [&fn, lo, hi]() { fn(lo, hi); });
+			}
+			wait(group);
+		}
+
+	private:
+		struct job_queue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> jobs;
+		};
+		std::vector<job_queue> queues;
+		std::vector<std::thread> threads;
+		std::mutex sleep_mutex;
+		std::condition_variable wake;
+		int queued = 0;	// guarded by sleep_mutex
+		bool stopping = false;
+		std::atomic<unsigned> next_queue{0};
+		static inline thread_local int worker_index = -1;
+
+		/* Own queue from the back first, then steal from the front of the others */
+		bool run_one() {
+			std::function<void()> job;
+			int n = queues.size();
+			int self = worker_index >= 0 ? worker_index : 0;
+			for(int k = 0; k < n && !job; k++) {
+				job_queue& q = queues[(self + k) % n];
+				std::lock_guard<std::mutex> lock(q.mutex);
+				if(q.jobs.empty())
+					continue;
+				if(k == 0 && worker_index >= 0) {
+					job = q.jobs.back();
+					q.jobs.pop_back();
+				} else {
+					job = q.jobs.front();
+					q.jobs.pop_front();
+				}
+			}
+			if(!job)
+				return false;
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				queued--;
+			}
+			PROFILE_SCOPE("job");
+			job();
+			return true;
+		}
+
+		void worker_loop(int index) {
+			worker_index = index;
+			PROFILE_THREAD("worker");
+			while(true) {
+				if(run_one())
+					continue;
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+				wake.wait(lock, [this]() { return queued > 0 || stopping; });
+				if(stopping && queued <= 0)
+					return;
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,24 @@
+#version 460
+
+struct instance_data {
+	vec4 position; // xyz position, w uniform scale
+	vec4 rotation; // unit quaternion, w is the real part
+};
+layout(std430, binding=0) buffer instance_list {
+	instance_data instances[];
+};
+layout(location = 0) in vec3 in_vertex;
+layout(location = 1) in vec2 in_texcoord;
+uniform mat4 vp;
+out vec2 frag_texcoord;
+
+vec3 quat_rotate(vec4 q, vec3 v) {
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main(void) {	
+	instance_data instance = instances[gl_BaseInstance + gl_InstanceID];
+	vec3 world = quat_rotate(instance.rotation, in_vertex * instance.position.w) + instance.position.xyz;
+	gl_Position = vp * vec4(world, 1.0);
+	frag_texcoord = in_texcoord;
+}
@@ -0,0 +1,16 @@
+#version 460
+
+// xyz is the position, w a uniform scale
+layout(std430, binding=0) buffer instance_list {
+	vec4 instances[];
+};
+layout(location = 0) in vec3 in_vertex;
+layout(location = 1) in vec2 in_texcoord;
+uniform mat4 vp;
+out vec2 frag_texcoord;
+
+void main(void) {	
+	vec4 instance = instances[gl_BaseInstance + gl_InstanceID];
+	gl_Position = vp * vec4(in_vertex * instance.w + instance.xyz, 1.0);
+	frag_texcoord = in_texcoord;
+}
@@ -0,0 +1,491 @@
+#ifndef MESH_TOOLS_H
+#define MESH_TOOLS_H
+
+#include<glm/glm.hpp>
+#include<vector>
+#include<cstdint>
+#include<cstddef>
+#include<string.h>
+#include<math.h>
+#include<algorithm>
+#include "game.h"
+#include "job_system.h"
+
+/* Mesh processing for load_model.  No GL in here, so the benchmarks can use it too. */
+
+/* Open addressing hash table from vertex to its index in a vertex array.
+ * Slots hold the index and the top half of the hash, so most mismatches are rejected without
+ * touching the vertex array.  Sized up front to at most half full, so it never rehashes.
+ */
+class vertex_table {
+	public:
+		/* expected is an upper bound on the number of distinct vertices */
+		explicit vertex_table(size_t expected) {
+			size_t capacity = 16;
+			while(capacity < 2 * expected)
+				capacity *= 2;
+			slots.assign(capacity, slot{EMPTY, 0});
+			mask = capacity - 1;
+		}
+
+		/* Index of v in vertices, appending it first if it isn't there */
+		uint32_t insert(vertex v, std::vector<vertex>& vertices) {
+			// -0 and 0 compare equal but hash differently
+			v.pos += glm::vec3(0.0f, 0.0f, 0.0f);
+			v.tex_coord += glm::vec2(0.0f, 0.0f);
+			uint64_t h = hash(v);
+			uint32_t tag = h >> 32;
+			for(size_t i = h & mask;; i = (i + 1) & mask) {
+				slot& s = slots[i];
+				if(s.index == EMPTY) {
+					s.index = vertices.size();
+					s.tag = tag;
+					vertices.push_back(v);
+					return s.index;
+				}
+				if(s.tag == tag && !memcmp(&vertices[s.index], &v, sizeof(vertex)))
+					return s.index;
+			}
+		}
+
+		static uint64_t hash(const vertex& v) {
+			uint32_t words[sizeof(vertex) / 4];
+			memcpy(words, &v, sizeof(words));
+			uint64_t h = 0x9e3779b97f4a7c15ull;
+			for(uint32_t w : words)
+				h = (h ^ w) * 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+			return h;
+		}
+
+	private:
+		static const uint32_t EMPTY = 0xffffffffu;
+		struct slot {
+			uint32_t index, tag;
+		};
+		std::vector<slot> slots;
+		size_t mask;
+};
+
+/* Builds an indexed mesh from per-corner vertices.  shape_sizes[s] is the number of corners in
+ * shape s and corner(s, i) returns the vertex for corner i of shape s.  Vertices come out in
+ * order of first use, appended to vertices (anything already there isn't matched against).
+ */
+template<typename F>
+void dedup_vertices(const std::vector<size_t>& shape_sizes, F corner, std::vector<vertex>& vertices, std::vector<uint32_t>& indices) {
+	size_t total = 0;
+	for(size_t n : shape_sizes)
+		total += n;
+	vertex_table table(total);
+	vertices.reserve(vertices.size() + total / 4);	// Closed meshes share each vertex about 6 ways
+	indices.reserve(indices.size() + total);
+	for(size_t s = 0; s < shape_sizes.size(); s++)
+		for(size_t i = 0; i < shape_sizes[s]; i++)
+			indices.push_back(table.insert(corner(s, i), vertices));
+}
+
+/* Same result as dedup_vertices, with the shapes deduplicated in parallel.
+ * Each shape gets its own table first, then the (much fewer) per-shape vertices are merged in
+ * shape order, which keeps the first use order, and the indices are remapped.
+ */
+template<typename F>
+void dedup_vertices_parallel(job_system& jobs, const std::vector<size_t>& shape_sizes, F corner, std::vector<vertex>& vertices, std::vector<uint32_t>& indices) {
+	size_t shape_count = shape_sizes.size();
+	if(shape_count < 2 || jobs.worker_count() == 1) {
+		dedup_vertices(shape_sizes, corner, vertices, indices);
+		return;
+	}
+	std::vector<size_t> starts(shape_count);
+	size_t total = 0;
+	for(size_t s = 0; s < shape_count; s++) {
+		starts[s] = total;
+		total += shape_sizes[s];
+	}
+	size_t first_index = indices.size();
+	indices.resize(first_index + total);
+	uint32_t* out = indices.data() + first_index;
+
+	// Shape-local vertices, with out holding shape-local indices
+	std::vector<std::vector<vertex>> local(shape_count);
+	jobs.parallel_for(0, shape_count, 1, [&](size_t lo, size_t hi) {
+		for(size_t s = lo; s < hi; s++) {
+			vertex_table table(shape_sizes[s]);
+			for(size_t i = 0; i < shape_sizes[s]; i++)
+				out[starts[s] + i] = table.insert(corner(s, i), local[s]);
+		}
+	});
+
+	size_t local_total = 0;
+	for(const std::vector<vertex>& l : local)
+		local_total += l.size();
+	vertex_table table(local_total);
+	std::vector<std::vector<uint32_t>> remap(shape_count);
+	for(size_t s = 0; s < shape_count; s++) {
+		remap[s].resize(local[s].size());
+		for(size_t i = 0; i < local[s].size(); i++)
+			remap[s][i] = table.insert(local[s][i], vertices);
+	}
+
+	jobs.parallel_for(0, shape_count, 1, [&](size_t lo, size_t hi) {
+		for(size_t s = lo; s < hi; s++)
+			for(size_t i = 0; i < shape_sizes[s]; i++)
+				out[starts[s] + i] = remap[s][out[starts[s] + i]];
+	});
+}
+
+/* Average cache miss ratio:  vertex shader runs per triangle with a FIFO post-transform cache
+ * of cache_size entries.  3 is the worst possible, about 0.5 the best for a big regular mesh.
+ */
+inline float acmr(const std::vector<uint32_t>& indices, size_t vertex_count, size_t cache_size = 16) {
+	if(indices.size() < 3)
+		return 0;
+	std::vector<size_t> cached_at(vertex_count, 0);	// Miss count when it went in, 0 for never
+	size_t misses = 0;
+	for(uint32_t v : indices) {
+		if(cached_at[v] && misses - cached_at[v] < cache_size)
+			continue;
+		misses++;
+		cached_at[v] = misses;
+	}
+	return misses / (float)(indices.size() / 3);
+}
+
+/* Reorders triangles for the post-transform vertex cache, following Tom Forsyth's "Linear-Speed
+ * Vertex Cache Optimisation".  Triangles are emitted greedily by score:  vertices score higher
+ * the more recently they went through a simulated LRU cache, and the fewer unemitted
+ * triangles they have left, so meshes get finished off locally instead of leaving holes.
+ */
+#define FORSYTH_CACHE_SIZE 32
+
+inline float forsyth_vertex_score(int cache_position, uint32_t remaining) {
+	if(!remaining)
+		return -1.0f;
+	float score = 0;
+	if(cache_position >= 0) {
+		if(cache_position < 3)	// Used by the last triangle, a fixed score so it isn't favoured too much
+			score = 0.75f;
+		else
+			score = powf(1.0f - (cache_position - 3) / (float)(FORSYTH_CACHE_SIZE - 3), 1.5f);
+	}
+	return score + 2.0f / sqrtf((float)remaining);
+}
+
+inline void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count) {
+	size_t triangle_count = indices.size() / 3;
+	if(triangle_count < 2 || indices.size() % 3)	// Not a triangle list, leave it alone
+		return;
+
+	// Triangles using each vertex
+	std::vector<uint32_t> remaining(vertex_count, 0), offsets(vertex_count + 1, 0);
+	for(uint32_t v : indices)
+		remaining[v]++;
+	for(size_t v = 0; v < vertex_count; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+	std::vector<uint32_t> adjacency(indices.size()), filled(offsets.begin(), offsets.end() - 1);
+	for(size_t t = 0; t < triangle_count; t++)
+		for(int k = 0; k < 3; k++)
+			adjacency[filled[indices[3*t + k]]++] = t;
+
+	std::vector<int> cache_position(vertex_count, -1);
+	std::vector<float> vertex_score(vertex_count);
+	for(size_t v = 0; v < vertex_count; v++)
+		vertex_score[v] = forsyth_vertex_score(-1, remaining[v]);
+	std::vector<float> triangle_score(triangle_count);
+	std::vector<bool> emitted(triangle_count, false);
+	for(size_t t = 0; t < triangle_count; t++)
+		triangle_score[t] = vertex_score[indices[3*t]] + vertex_score[indices[3*t + 1]] + vertex_score[indices[3*t + 2]];
+
+	std::vector<uint32_t> cache, next_cache, output;
+	output.reserve(indices.size());
+	size_t scan = 0;	// Everything before this has been emitted
+	long best = -1;
+	while(output.size() < indices.size()) {
+		if(best < 0) {	// Nothing in the cache has triangles left, start again from the next unemitted one
+			while(emitted[scan])
+				scan++;
+			best = scan;
+			for(size_t t = scan + 1; t < triangle_count && t < scan + 64; t++)	// A little lookahead is cheap
+				if(!emitted[t] && triangle_score[t] > triangle_score[best])
+					best = t;
+		}
+		const uint32_t* tri = &indices[3*best];
+		emitted[best] = true;
+		output.insert(output.end(), tri, tri + 3);
+
+		// The triangle's vertices go to the front of the cache, everything else shuffles down
+		next_cache.assign(tri, tri + 3);
+		for(int k = 0; k < 3; k++) {
+			uint32_t v = tri[k];
+			uint32_t* list = &adjacency[offsets[v]];
+			for(uint32_t j = 0; j < remaining[v]; j++)
+				if(list[j] == (uint32_t)best) {
+					list[j] = list[remaining[v] - 1];
+					break;
+				}
+			remaining[v]--;
+		}
+		for(uint32_t v : cache)
+			if(v != tri[0] && v != tri[1] && v != tri[2])
+				next_cache.push_back(v);
+		for(size_t i = 0; i < next_cache.size(); i++) {
+			uint32_t v = next_cache[i];
+			cache_position[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+			vertex_score[v] = forsyth_vertex_score(cache_position[v], remaining[v]);
+		}
+
+		// Only triangles touching the cache (or just evicted from it) changed score, and the next one comes from them
+		best = -1;
+		float best_score = -1.0f;
+		for(uint32_t v : next_cache) {
+			const uint32_t* list = &adjacency[offsets[v]];
+			for(uint32_t j = 0; j < remaining[v]; j++) {
+				uint32_t t = list[j];
+				float score = vertex_score[indices[3*t]] + vertex_score[indices[3*t + 1]] + vertex_score[indices[3*t + 2]];
+				triangle_score[t] = score;
+				if(score > best_score) {
+					best_score = score;
+					best = t;
+				}
+			}
+		}
+		if(next_cache.size() > FORSYTH_CACHE_SIZE)
+			next_cache.resize(FORSYTH_CACHE_SIZE);
+		cache.swap(next_cache);
+	}
+	indices.swap(output);
+}
+
+/* Renumbers vertices in the order the indices first use them, so vertex fetches walk
+ * forwards through memory.  Run after optimize_vertex_cache.
+ */
+inline void optimize_vertex_fetch(std::vector<vertex>& vertices, std::vector<uint32_t>& indices) {
+	std::vector<uint32_t> remap(vertices.size(), 0xffffffffu);
+	std::vector<vertex> reordered;
+	reordered.reserve(vertices.size());
+	for(uint32_t& i : indices) {
+		if(remap[i] == 0xffffffffu) {
+			remap[i] = reordered.size();
+			reordered.push_back(vertices[i]);
+		}
+		i = remap[i];
+	}
+	vertices.swap(reordered);	// Vertices no triangle uses are dropped
+}
+
+/* Quadric error metric (Garland and Heckbert):  the sum of squared distances from a point to a
+ * set of planes, each weighted by its triangle's area.  w is the total weight, so
+ * sqrt(eval(p) / w) is an RMS distance in model units.
+ */
+struct quadric {
+	double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+	double b0 = 0, b1 = 0, b2 = 0, c = 0, w = 0;
+
+	/* Plane through p with normal n, weighted by the length of n */
+	static quadric plane(glm::vec3 p, glm::vec3 n) {
+		quadric q;
+		double area = sqrt((double)n.x * n.x + (double)n.y * n.y + (double)n.z * n.z);
+		if(area <= 0)
+			return q;
+		double x = n.x / area, y = n.y / area, z = n.z / area;
+		double d = -(x * p.x + y * p.y + z * p.z);
+		q.a00 = area * x * x; q.a01 = area * x * y; q.a02 = area * x * z;
+		q.a11 = area * y * y; q.a12 = area * y * z; q.a22 = area * z * z;
+		q.b0 = area * x * d; q.b1 = area * y * d; q.b2 = area * z * d;
+		q.c = area * d * d;
+		q.w = area;
+		return q;
+	}
+	void add(const quadric& q) {
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; w += q.w;
+	}
+	double eval(glm::vec3 p) const {
+		double x = p.x, y = p.y, z = p.z;
+		return	a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + a11 * y * y + 2 * a12 * y * z + a22 * z * z +
+			2 * (b0 * x + b1 * y + b2 * z) + c;
+	}
+};
+
+/* Simplifies a mesh by edge collapse until it has at most target_index_count indices or
+ * nothing more can go, and returns the new indices.  Vertices only ever collapse onto one of
+ * their neighbours, so the result uses a subset of the same vertex array.  Vertices on texture
+ * seams (another vertex at the same position) and on open borders stay put, which keeps UVs
+ * and outlines intact at the cost of some reduction.  *error gets the worst RMS distance from
+ * the original surface of any collapse, in model units.
+ * Collapses are made in passes, cheapest first, each vertex touched at most once per pass so
+ * the costs and flip checks worked out at the start of a pass stay valid.
+ */
+inline std::vector<uint32_t> simplify_mesh(const std::vector<vertex>& vertices, const std::vector<uint32_t>& source, size_t target_index_count, float* error) {
+	size_t vertex_count = vertices.size();
+	std::vector<uint32_t> indices(source);
+	*error = 0;
+
+	// Position classes:  vertices split only by texture coordinates share a class
+	std::vector<uint32_t> order(vertex_count), position_class(vertex_count);
+	for(size_t v = 0; v < vertex_count; v++)
+		order[v] = v;
+	auto position_less = [&](uint32_t a, uint32_t b) {
+		const glm::vec3 &p = vertices[a].pos, &q = vertices[b].pos;
+		return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+	};
+	std::sort(order.begin(), order.end(), position_less);
+	std::vector<bool> locked(vertex_count, false);
+	for(size_t i = 0, classes = 0; i < vertex_count; i++) {
+		if(i && position_less(order[i - 1], order[i]))
+			classes++;
+		position_class[order[i]] = classes;
+		if(i && !position_less(order[i - 1], order[i]))	// Seam
+			locked[order[i - 1]] = locked[order[i]] = true;
+	}
+
+	// Borders and non-manifold edges:  anything other than exactly two triangles on an edge
+	std::vector<uint64_t> edges;
+	edges.reserve(indices.size());
+	for(size_t t = 0; t + 2 < indices.size(); t += 3)
+		for(int k = 0; k < 3; k++) {
+			uint64_t a = position_class[indices[t + k]], b = position_class[indices[t + (k + 1) % 3]];
+			edges.push_back(a < b ? a << 32 | b : b << 32 | a);
+		}
+	std::sort(edges.begin(), edges.end());
+	std::vector<bool> locked_class(vertex_count, false);
+	for(size_t i = 0; i < edges.size();) {
+		size_t j = i;
+		while(j < edges.size() && edges[j] == edges[i])
+			j++;
+		if(j - i != 2)
+			locked_class[edges[i] >> 32] = locked_class[edges[i] & 0xffffffffu] = true;
+		i = j;
+	}
+	for(size_t v = 0; v < vertex_count; v++)
+		if(locked_class[position_class[v]])
+			locked[v] = true;
+
+	std::vector<quadric> quadrics(vertex_count);	// By position class
+	for(size_t t = 0; t + 2 < indices.size(); t += 3) {
+		glm::vec3 p0 = vertices[indices[t]].pos, p1 = vertices[indices[t + 1]].pos, p2 = vertices[indices[t + 2]].pos;
+		quadric q = quadric::plane(p0, glm::cross(p1 - p0, p2 - p0));
+		for(int k = 0; k < 3; k++)
+			quadrics[position_class[indices[t + k]]].add(q);
+	}
+
+	struct collapse {
+		float cost;
+		uint32_t from, to;
+		bool operator<(const collapse& o) const { return cost < o.cost; }
+	};
+	std::vector<collapse> candidates;
+	std::vector<uint32_t> remaining, offsets, adjacency, remap(vertex_count);
+	std::vector<bool> touched;
+	for(int pass = 0; pass < 64 && indices.size() > target_index_count; pass++) {
+		size_t triangle_count = indices.size() / 3;
+		remaining.assign(vertex_count, 0);
+		for(uint32_t v : indices)
+			remaining[v]++;
+		offsets.assign(vertex_count + 1, 0);
+		for(size_t v = 0; v < vertex_count; v++)
+			offsets[v + 1] = offsets[v] + remaining[v];
+		adjacency.resize(indices.size());
+		std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+		for(size_t t = 0; t < triangle_count; t++)
+			for(int k = 0; k < 3; k++)
+				adjacency[filled[indices[3*t + k]]++] = t;
+
+		auto cost = [&](uint32_t from, uint32_t to) {
+			quadric q = quadrics[position_class[from]];
+			if(position_class[from] != position_class[to])
+				q.add(quadrics[position_class[to]]);
+			return q.w > 0 ? (float)(fmax(q.eval(vertices[to].pos), 0.0) / q.w) : 0.0f;
+		};
+		candidates.clear();
+		for(size_t t = 0; t < triangle_count; t++)
+			for(int k = 0; k < 3; k++) {
+				uint32_t a = indices[3*t + k], b = indices[3*t + (k + 1) % 3];
+				if(!locked[a])
+					candidates.push_back(collapse{cost(a, b), a, b});
+				if(!locked[b])
+					candidates.push_back(collapse{cost(b, a), b, a});
+			}
+		std::sort(candidates.begin(), candidates.end());
+
+		// An interior collapse takes two triangles with it
+		size_t wanted = (indices.size() - target_index_count) / 6 + 1;
+		size_t collapses = 0;
+		touched.assign(vertex_count, false);
+		for(size_t v = 0; v < vertex_count; v++)
+			remap[v] = v;
+		for(const collapse& c : candidates) {
+			if(collapses >= wanted)
+				break;
+			if(touched[c.from] || touched[c.to])
+				continue;
+			// Reject collapses that would turn a surviving triangle over
+			glm::vec3 to = vertices[c.to].pos;
+			bool flips = false;
+			const uint32_t* around = &adjacency[offsets[c.from]];
+			for(uint32_t j = 0; j < remaining[c.from] && !flips; j++) {
+				const uint32_t* tri = &indices[3 * around[j]];
+				if(tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+					continue;
+				glm::vec3 p[3], q[3];
+				for(int k = 0; k < 3; k++) {
+					p[k] = vertices[tri[k]].pos;
+					q[k] = tri[k] == c.from ? to : p[k];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]), after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(before, after) <= 0.0f;
+			}
+			if(flips)
+				continue;
+			remap[c.from] = c.to;
+			for(uint32_t j = 0; j < remaining[c.from]; j++) {
+				const uint32_t* tri = &indices[3 * around[j]];
+				for(int k = 0; k < 3; k++)
+					touched[tri[k]] = true;
+			}
+			if(position_class[c.from] != position_class[c.to])
+				quadrics[position_class[c.to]].add(quadrics[position_class[c.from]]);
+			*error = fmaxf(*error, sqrtf(c.cost));
+			collapses++;
+		}
+		if(!collapses)
+			break;
+
+		size_t kept = 0;
+		for(size_t t = 0; t < triangle_count; t++) {
+			uint32_t a = remap[indices[3*t]], b = remap[indices[3*t + 1]], c = remap[indices[3*t + 2]];
+			if(a == b || b == c || c == a)
+				continue;
+			indices[kept++] = a;
+			indices[kept++] = b;
+			indices[kept++] = c;
+		}
+		indices.resize(kept);
+	}
+	return indices;
+}
+
+/* Level of detail chain for an indexed mesh:  indices comes in holding the full detail mesh and
+ * goes out with up to MAX_LODS meshes back to back, each about half the last, all using the
+ * same vertices.  Stops early once halving stops working or the mesh gets small.
+ */
+#define LOD_MIN_TRIANGLES 64
+
+inline void build_lods(const std::vector<vertex>& vertices, std::vector<uint32_t>& indices, std::vector<mesh_lod>& lods) {
+	lods.assign(1, mesh_lod{0, (uint32_t)indices.size(), 0.0f});
+	std::vector<uint32_t> full(indices);
+	size_t previous = full.size();
+	while(lods.size() < MAX_LODS && previous / 3 >= 2 * LOD_MIN_TRIANGLES) {
+		float error;
+		std::vector<uint32_t> lod = simplify_mesh(vertices, full, previous / 2, &error);
+		if(lod.size() > previous * 3 / 4)
+			break;
+		optimize_vertex_cache(lod, vertices.size());
+		lods.push_back(mesh_lod{(uint32_t)indices.size(), (uint32_t)lod.size(), error});
+		indices.insert(indices.end(), lod.begin(), lod.end());
+		previous = lod.size();
+	}
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include<stdio.h>
+#include<stdint.h>
+#include<string.h>
+#include<chrono>
+#include<atomic>
+#include<mutex>
+#include<memory>
+#include<vector>
+
+/* Scope timing for the hot paths, written out as a Chrome trace (chrome://tracing, or
+ * ui.perfetto.dev) to see where each tick and frame goes on every thread.
+ * Put PROFILE_SCOPE("name") at the top of a block to record it, from start to the end of the
+ * block.  name has to outlive the profiler, so string literals or file names.  Only built
+ * with -DPROFILE (make profile);  otherwise the macros are empty and cost nothing.
+ *
+ * Each thread records into its own ring of PROFILE_RING_EVENTS, so recording takes no locks
+ * and a thread never waits on another.  Once a ring is full the oldest events are dropped,
+ * so a trace covers about the last PROFILE_RING_EVENTS scopes of each thread.
+ */
+#define PROFILE_RING_EVENTS (1 << 16)
+
+struct profile_event {
+	const char* name;
+	uint64_t start, end;	// ns since the profiler started
+};
+
+/* One writer, the thread it belongs to.  Dumping can read it at any time. */
+struct profile_ring {
+	profile_event events[PROFILE_RING_EVENTS];
+	std::atomic<uint64_t> written{0};
+	int tid = 0;
+	const char* thread_name = 0;
+
+	void push(const char* name, uint64_t start, uint64_t end) {
+		uint64_t n = written.load(std::memory_order_relaxed);
+		profile_event& e = events[n & (PROFILE_RING_EVENTS - 1)];
+		e.name = name;
+		e.start = start;
+		e.end = end;
+		written.store(n + 1, std::memory_order_release);
+	}
+};
+
+class profiler {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		static profiler& get() {
+			static profiler p;
+			return p;
+		}
+
+		uint64_t now() const {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started).count();
+		}
+
+		/* This thread's ring, made the first time it records anything */
+		profile_ring& ring() {
+			if(!this_thread) {
+				std::lock_guard<std::mutex> lock(rings_mutex);
+				rings.push_back(std::unique_ptr<profile_ring>(new profile_ring));
+				this_thread = rings.back().get();
+				this_thread->tid = rings.size();
+			}
+			return *this_thread;
+		}
+
+		/* Shown for this thread in the trace, instead of its number */
+		void name_thread(const char* name) { ring().thread_name = name; }
+
+		/* Writes everything in the rings as Chrome trace JSON.  Other threads can keep recording
+		 * meanwhile;  whatever they overwrite while it's being copied is left out.
+		 */
+		int write_trace(const char* filename) {
+			FILE* f = fopen(filename, "w");
+			if(!f) {
+				printf("Couldn't write trace to %s\n", filename);
+				return 1;
+			}
+			std::vector<profile_event> events;
+			size_t total = 0;
+			fputs("{\"traceEvents\":[\n", f);
+			std::lock_guard<std::mutex> lock(rings_mutex);
+			bool first = true;
+			for(auto& r : rings) {
+				uint64_t end = r->written.load(std::memory_order_acquire);
+				uint64_t begin = end > PROFILE_RING_EVENTS ? end - PROFILE_RING_EVENTS : 0;
+				events.clear();
+				for(uint64_t i = begin; i < end; i++)
+					events.push_back(r->events[i & (PROFILE_RING_EVENTS - 1)]);
+				// Anything lapped while copying may be half overwritten
+				uint64_t after = r->written.load(std::memory_order_acquire);
+				size_t skip = after - begin > PROFILE_RING_EVENTS ? after - begin - PROFILE_RING_EVENTS : 0;
+
+				char thread_name[32];
+				if(!r->thread_name)
+					snprintf(thread_name, sizeof(thread_name), "thread %d", r->tid);
+				fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", r->tid, r->thread_name ? r->thread_name : thread_name);
+				first = false;
+				for(size_t i = skip; i < events.size(); i++) {
+					const profile_event& e = events[i];
+					fprintf(f, ",\n{\"ph\":\"X\",\"name\":\"");
+					write_escaped(f, e.name);
+					fprintf(f, "\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", r->tid, e.start / 1000.0, (e.end - e.start) / 1000.0);
+				}
+				total += events.size() - skip;
+			}
+			fputs("\n]}\n", f);
+			fclose(f);
+			printf("Wrote %zu profile events from %zu threads to %s\n", total, rings.size(), filename);
+			return 0;
+		}
+
+	private:
+		clock::time_point started = clock::now();
+		std::mutex rings_mutex;
+		std::vector<std::unique_ptr<profile_ring>> rings;
+		static inline thread_local profile_ring* this_thread = 0;
+
+		static void write_escaped(FILE* f, const char* s) {
+			for(; *s; s++) {
+				if(*s == '"' || *s == '\\')
+					fputc('\\', f);
+				fputc(*s, f);
+			}
+		}
+};
+
+/* Records from construction to destruction */
+class profile_scope {
+	public:
+		profile_scope(const char* n) : name(n), start(profiler::get().now()) {}
+		~profile_scope() {
+			profiler& p = profiler::get();
+			p.ring().push(name, start, p.now());
+		}
+	private:
+		const char* name;
+		uint64_t start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#ifdef PROFILE
+#define PROFILE_SCOPE(name) profile_scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_THREAD(name) profiler::get().name_thread(name)
+#define PROFILE_WRITE_TRACE(filename) profiler::get().write_trace(filename)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_THREAD(name)
+#define PROFILE_WRITE_TRACE(filename)
+#endif
+
+#endif
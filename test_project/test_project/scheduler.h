@@ -0,0 +1,119 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include<stdio.h>
+#include<vector>
+#include<chrono>
+#include<thread>
+#include<atomic>
+#include "profiler.h"
+#include "histogram.h"
+
+/* Timing for one phase, every run's time */
+struct phase_stats {
+	hdr_histogram times;
+};
+
+struct sim_phase {
+	const char* name;
+	void (*run)();
+	int period;	// run every period ticks
+	phase_stats stats;
+};
+
+/* Runs the simulation on one thread with a fixed timestep.
+ * Real time goes into an accumulator and whole ticks are taken out of it, so the tick rate
+ * doesn't depend on how long each tick took or how late the OS woke us up.  If we fall
+ * behind, up to max_catchup ticks run back to back; anything past that is dropped rather
+ * than letting the backlog grow forever.
+ * Phases run in the order they were added, every tick (or every period ticks).
+ * Every tick's time goes in tick_times, and how late it finished in overruns:  a tick falls due
+ * when the accumulator reaches dt and should be done one dt after that.
+ */
+class tick_scheduler {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		std::chrono::microseconds dt;
+		int max_catchup;
+		std::vector<sim_phase> phases;
+		unsigned long tick_count = 0;
+		unsigned long dropped_ticks = 0;
+		unsigned long catchup_ticks = 0;	// ticks that ran late, back to back
+		hdr_histogram tick_times, overruns;
+		double report_seconds = 0;	// Print stats this often from run(), if set
+
+		tick_scheduler(std::chrono::microseconds step = std::chrono::microseconds(1000), int catchup = 5) : dt(step), max_catchup(catchup) {}
+
+		void add_phase(const char* name, void (*run)(), int period = 1) {
+			sim_phase p = {name, run, period};
+			phases.push_back(p);
+		}
+
+		void tick() {
+			PROFILE_SCOPE("tick");
+			auto tick_start = clock::now();
+			for(sim_phase& p : phases) {
+				if(tick_count % p.period)
+					continue;
+				PROFILE_SCOPE(p.name);
+				auto start = clock::now();
+				p.run();
+				p.stats.times.record(clock::now() - start);
+			}
+			tick_times.record(clock::now() - tick_start);
+			tick_count++;
+		}
+
+		void run(const std::atomic<int>& shutdown) {
+			clock::time_point previous = clock::now();
+			clock::duration accumulator = clock::duration::zero();
+			clock::time_point next_report = previous + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(report_seconds));
+			while(!shutdown) {
+				clock::time_point now = clock::now();
+				accumulator += now - previous;
+				previous = now;
+
+				int steps = 0;
+				while(accumulator >= dt && steps < max_catchup) {
+					clock::time_point deadline = now - accumulator + 2 * dt;
+					tick();
+					clock::time_point finished = clock::now();
+					overruns.record(finished > deadline ? finished - deadline : clock::duration::zero());
+					accumulator -= dt;
+					steps++;
+				}
+				if(steps > 1)
+					catchup_ticks += steps - 1;
+				if(accumulator >= dt) {
+					dropped_ticks += accumulator / dt;
+					accumulator %= dt;
+				}
+				if(report_seconds > 0 && now >= next_report) {
+					print_stats();
+					next_report = now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(report_seconds));
+				}
+				std::this_thread::sleep_until(now + (dt - accumulator));
+			}
+		}
+
+		void print_stats() {
+			printf("Simulation:  %lu ticks, %lu caught up, %lu dropped\n", tick_count, catchup_ticks, dropped_ticks);
+			tick_times.print("tick");
+			if(overruns.count())
+				overruns.print("overrun");
+			for(sim_phase& p : phases)
+				p.stats.times.print(p.name);
+		}
+
+		/* print_stats as CSV rows, under hdr_histogram::csv_header */
+		void write_csv(FILE* f) {
+			tick_times.csv_row(f, "tick");
+			if(overruns.count())
+				overruns.csv_row(f, "overrun");
+			for(sim_phase& p : phases)
+				p.stats.times.csv_row(f, p.name);
+		}
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "sim.h"
+
+/* Global section */
+int time_resolution = 10;
+
+/* Player globals */
+glm::vec3 player_position;
+triple_buffer<glm::vec3> camera_position;
+float player_heading;
+float player_height = 2;
+float player_elevation;
+float player_fall_speed = 0;
+float player_speed = .6f;
+bool player_dead = false;
+gameobject* player_platform = 0;
+uint32_t player_platform_handle = NO_INSTANCE;
+struct key_status player_key_status;
+
+std::vector<gameobject*> objects;
+
+job_system jobs;
+
+projectile ice_balls;
+fragment brick_fragments;
+
+float randvel(float speed) {
+	long min = -100;
+	long max = 100;
+	return speed * (min + rand() % (max + 1 - min));
+}
+
+void fire(bool burst){
+	ice_balls.add_projectile(player_position, player_heading, player_elevation, 1.6f, 10000.0f, 1.0f, burst);
+}
+
+long is_empty(glm::vec3 position, float distance){
+        for(gameobject* o : objects) {
+                long collide_index = o->collision_index(position, 0.2f);
+                if(collide_index != -1)
+                        return false;
+        }
+        return true;
+
+}
+
+void player_movement(){
+	glm::vec3 step_to_point = player_position;
+	if(player_key_status.forward){
+		step_to_point += player_speed * glm::vec3(sinf(player_heading), 0, cosf(player_heading));
+	}
+	if(player_key_status.backward){
+		step_to_point += player_speed * glm::vec3(-sinf(player_heading), 0, -cosf(player_heading));
+	}
+	if(player_key_status.left){
+		step_to_point += player_speed * glm::vec3(sinf(player_heading + M_PI/2), 0, cosf(player_heading + M_PI/2));
+	}
+	if(player_key_status.right){
+		step_to_point += player_speed * glm::vec3(-sinf(player_heading + M_PI/2), 0, -cosf(player_heading + M_PI/2));
+	}
+        for(gameobject* o : objects) {
+                long collide_index = o->collision_index(step_to_point, 0.2f);
+                if(collide_index != -1) {
+                        if(is_empty(glm::vec3(player_position.x, step_to_point.y, step_to_point.z), 0.2f)) {
+                                step_to_point.x = player_position.x;
+                                break;
+                        }
+                        else if(is_empty(glm::vec3(step_to_point.x, step_to_point.y, player_position.z), 0.2f)) {
+                                step_to_point.z = player_position.z;
+                                break;
+                        }
+                        else {
+                                step_to_point = player_position;
+                                break;
+                        }
+
+
+                }
+        }
+        player_position = step_to_point;
+
+	if(player_platform){
+		uint32_t ppi = player_platform->handles.index_of(player_platform_handle);
+		if(ppi == NO_INSTANCE || !player_platform->is_on_idx(player_position, ppi))
+			player_platform = 0;
+	} else {
+		float floor_height = 0;
+		for(gameobject* o : objects) {
+			long ppi = o->is_on(player_position);
+			if(ppi != -1) {
+				player_platform_handle = o->handles.handle_of(ppi);
+				player_platform = o;	
+				floor_height = player_platform->locations[ppi].y + (player_platform->size.y / 2);
+				player_fall_speed = 0;
+				player_position.y = floor_height + player_height; 
+			}
+		}
+		if(player_position.y - player_height > floor_height) {
+			player_position.y += player_fall_speed;
+			player_fall_speed -= GRAVITY;
+		} else {
+			player_fall_speed = 0;
+			player_position.y = floor_height + player_height; 
+		}
+	}
+}
+
+/* Objects move one after another:  the turret reaches into ice_balls under its mutex, so running
+ * moves side by side could deadlock a worker that picks up the turret while it holds that lock.
+ * The objects with lots of instances split their own move() across the job system instead.
+ */
+void object_movement(){
+	if(player_platform){
+		uint32_t ppi = player_platform->handles.index_of(player_platform_handle);
+		if(ppi != NO_INSTANCE) {
+			glm::vec3 pltloc = player_platform->locations[ppi];
+			float floor_height = pltloc.y + (player_platform->size.y / 2);
+			player_position.y = floor_height + player_height;
+		} else {
+			player_platform = 0;
+		}
+	}
+	for(gameobject* o : objects) {
+		PROFILE_SCOPE(o->label());
+		o->move();
+	}
+}
+
+void animation(){
+	job_group group;
+	for(gameobject* o : objects)
+		jobs.run(group, [o]() { o->animate(); });
+	jobs.wait(group);
+}
+
+/* Finding hits is read only, so that's spread across the workers.  Hits are then applied in
+ * projectile order on this thread, re-checked since an earlier hit may have removed the target.
+ * Objects with up to SIMD_SWEEP_MAX instances are tested with the SIMD box kernel, 8 boxes at a
+ * time.  Past that the grid wins, since it only looks at nearby instances.
+ */
+#define SIMD_SWEEP_MAX AABB_STACK_BOXES	// So the sweep never allocates
+std::vector<char> hit_candidates;
+std::vector<aabb_soa> sweep_boxes;
+std::vector<char> sweep_with_boxes;
+void collision_detection(){
+	ice_balls.data_mutex.lock();
+	sweep_boxes.resize(objects.size());
+	sweep_with_boxes.assign(objects.size(), 0);
+	for(size_t k = 0; k < objects.size(); k++){
+		gameobject* o = objects[k];
+		if(!o->collision_check)
+			continue;
+		if(o->locations.size() <= SIMD_SWEEP_MAX)
+			sweep_with_boxes[k] = o->collision_boxes(sweep_boxes[k]);
+	}
+	size_t count = ice_balls.locations.size();
+	hit_candidates.assign(count, 0);
+	jobs.parallel_for(0, count, JOB_GRAIN / 4, [](size_t lo, size_t hi) {
+		PROFILE_SCOPE("collision sweep");
+		static thread_local std::vector<long> first_hit;	// Each worker's, only ever grows
+		if(first_hit.size() < hi - lo)
+			first_hit.resize(hi - lo);
+		for(size_t k = 0; k < objects.size(); k++){
+			gameobject* o = objects[k];
+			if(!o->collision_check)
+				continue;
+			PROFILE_SCOPE(o->label());
+			if(sweep_with_boxes[k]) {
+				aabb_first_hits(sweep_boxes[k], &ice_balls.locations[lo], hi - lo, first_hit.data());
+				for(size_t i = lo; i < hi; i++)
+					if(first_hit[i - lo] != -1)
+						hit_candidates[i] = 1;
+			} else {
+				for(size_t i = lo; i < hi; i++)
+					if(!hit_candidates[i] && o->collision_index(ice_balls.locations[i]) != -1)
+						hit_candidates[i] = 1;
+			}
+		}
+	});
+	PROFILE_SCOPE("collision hits");
+	for(size_t proj_index = 0; proj_index < count; proj_index++){
+		if(!hit_candidates[proj_index])
+			continue;
+		glm::vec3 l = ice_balls.locations[proj_index];
+		for(auto o : objects){
+			if(o->collision_check){
+				long index = o->collision_index(l);
+				if(index != -1) {
+					o->hit_index(index);
+					ice_balls.hit_index(proj_index);
+					break;
+				}
+			}
+		}
+	}	
+	ice_balls.data_mutex.unlock();
+}
+
+/* Hand the render thread a consistent copy of everything it draws */
+void publish(){
+	job_group group;
+	for(gameobject* o : objects)
+		jobs.run(group, [o]() {
+			PROFILE_SCOPE(o->label());
+			o->publish();
+		});
+	jobs.wait(group);
+	camera_position.write_slot() = player_position;
+	camera_position.publish();
+}
+
+/* Animation every 10 ticks, snapshots every 4, which with 1 ms ticks is faster than we render */
+void add_sim_phases(tick_scheduler& scheduler){
+	scheduler.add_phase("player_movement", player_movement);
+	scheduler.add_phase("object_movement", object_movement);
+	scheduler.add_phase("collision_detection", collision_detection);
+	scheduler.add_phase("animation", animation, 10);
+	scheduler.add_phase("publish", publish, 4);
+}
@@ -0,0 +1,558 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<glm/glm.hpp>
+#include<glm/gtc/matrix_transform.hpp>
+#include<vector>
+#include<mutex>
+#include<atomic>
+
+#include "spatial_grid.h"
+#include "job_system.h"
+#include "snapshot.h"
+#include "instance_handles.h"
+#include "simd_kernels.h"
+#include "scheduler.h"
+#include "profiler.h"
+
+/* The simulation:  objects, physics, collision and the turret, with no GL anywhere, so it
+ * links on its own (libsim.a) and can be run and profiled without a display.  Objects only
+ * reach the renderer through their snapshots, which publish() fills once a tick.
+ * Globals are defined in sim.cpp.
+ */
+
+#define _USE_MATH_DEFINES
+#define GRAVITY 0.015f
+#define M_PI 3.14159265f
+
+class gameobject;
+
+extern int time_resolution;
+
+/* Player globals */
+extern glm::vec3 player_position;
+extern triple_buffer<glm::vec3> camera_position; // player_position as of the last published tick
+extern float player_heading;
+extern float player_height;
+extern float player_elevation;
+extern float player_fall_speed;
+extern float player_speed;
+extern bool player_dead;
+extern gameobject* player_platform;
+extern uint32_t player_platform_handle; // Platforms can be removed, so not an index
+
+struct key_status {
+	int forward, backward, left, right;
+};
+extern struct key_status player_key_status;
+
+extern std::vector<gameobject*> objects;
+
+/* Started in main, runs inline until then */
+extern job_system jobs;
+
+/* speed times a random whole number from -100 to 100 */
+float randvel(float speed);
+
+class gameobject {
+	public:
+		bool collision_check = false;
+		std::vector<glm::vec3> locations;
+		glm::vec3 size; // What about non-square objects?
+		virtual ~gameobject() {}
+		virtual void move() {}
+		virtual void animate() {}
+		/* Copy this tick's instances to snapshots, for the render thread */
+		virtual void publish() {}
+		triple_buffer<instance_snapshot> snapshots;
+		virtual const char* label() { return "object"; }
+		virtual bool is_on_idx(glm::vec3 position, size_t index) {return false;}
+		virtual long is_on(glm::vec3 position) {return -1;}
+		virtual long collision_index(glm::vec3 position, float distance = 0) {
+			return -1;
+		}
+		virtual glm::vec3 collision_normal(glm::vec3 move_to, glm::vec3 old_position, long index, float distance = 0) {
+			return glm::vec3(0, 0, 0);
+		}
+		virtual bool collision_with_index(glm::vec3 position, size_t index, float distance = 0) { return false; }//GO BACK TO THIS
+		/* Fills boxes with one AABB per instance if collision_index is a plain box test,
+		 * so the collision sweep can use the SIMD kernel.  Returns false otherwise.
+		 */
+		virtual bool collision_boxes(aabb_soa& boxes) { return false; }
+		virtual void hit_index(long index) {}
+
+		/* Instances are added with add_location and removed with remove_location, which
+		 * swap_pops, so indices aren't stable across removals.  Hold a handle to keep track of one.
+		 * Subclasses with more per-instance arrays swap_pop those themselves.
+		 */
+		instance_handles handles;
+		uint32_t add_location(glm::vec3 p) {
+			locations.push_back(p);
+			if(grid.built())
+				grid.insert(locations.size() - 1, p);
+			else
+				grid.build(locations, fmaxf(fmaxf(size.x, size.y), fmaxf(size.z, GRID_MIN_CELL)));
+			return handles.add();
+		}
+		void remove_location(size_t index) {
+			size_t last = locations.size() - 1;
+			grid.remove(index, last, locations[last]);
+			swap_pop(locations, index);
+			handles.remove(index);
+		}
+
+		/* Spatial lookup over locations.  It's kept up to date where locations are written, by
+		 * add_location, remove_location and set_location (anything writing locations directly has
+		 * to update the grid itself), so queries only read it and can run on several threads.
+		 */
+		spatial_grid grid;
+		void set_location(size_t index, glm::vec3 p) {
+			grid.update(index, p);
+			locations[index] = p;
+		}
+		/* Lowest index whose box (size/2 + distance around it) contains position, from nearby cells only */
+		long box_query(glm::vec3 position, float distance) const {
+			glm::vec3 half = size / 2.0f + glm::vec3(distance, distance, distance);
+			return grid.query(position - half, position + half, [&](size_t i) {
+				glm::vec3 l = locations[i];
+				return	half.x > abs(l.x-position.x) &&
+					half.y > abs(l.y-position.y) &&
+					half.z > abs(l.z-position.z);
+			});
+		}
+};
+
+class activation_area : public gameobject {
+	public:
+		std::vector<void (*)()> callbacks;
+		activation_area() {
+			collision_check = false;
+		}
+		void add_area(glm::vec3 location, void (*callback_function)()){
+			add_location(location);
+			callbacks.push_back(callback_function);
+		}
+		long collision_index(glm::vec3 position, float distance = 0){
+			long i = box_query(position, distance);
+			if(i != -1)
+				callbacks[i]();
+			return i;
+		}
+};
+
+class loaded_object : public gameobject {
+	public:
+		const char *objectfile, *texturefile;
+		float scale = 1.0f;
+		bool swap_yz = false;
+		instance_format format = INSTANCE_VEC4;
+		loaded_object(const char* of, const char* tf, glm::vec3 s) : objectfile(of), texturefile(tf) {
+			size = s;
+			collision_check = true;
+		}
+
+		const char* label() override { return objectfile; }
+		size_t instance_stride() { return ::instance_stride(format); }
+
+		/* Fill dst with count instances laid out for format.  Objects that rotate override this. */
+		virtual void write_instances(char* dst, size_t count) {
+			for(size_t i = 0; i < count; i++) {
+				glm::vec3 l = locations[i];
+				switch(format) {
+					case INSTANCE_VEC4:
+						((glm::vec4*)dst)[i] = glm::vec4(l, 1.0f);
+						break;
+					case INSTANCE_QUAT:
+						((glm::vec4*)dst)[2*i] = glm::vec4(l, 1.0f);
+						((glm::vec4*)dst)[2*i + 1] = glm::vec4(0, 0, 0, 1);
+						break;
+					default:
+						((glm::mat4*)dst)[i] = translate(glm::mat4(1.0f), l);
+				}
+			}
+		}
+
+		void publish() override {
+			instance_snapshot& s = snapshots.write_slot();
+			s.count = locations.size();
+			s.data.resize(s.count * instance_stride());
+			write_instances(s.data.data(), s.count);
+			snapshots.publish();
+		}
+
+		bool is_on_idx(glm::vec3 position, size_t index){
+			return (0.0f < (position.y - locations[index].y) && 
+					1.0f > (player_position.y - player_height) - (locations[index].y + size.y/2) &&
+					size.x/2 > fabs(position.x - locations[index].x) && 
+					size.z/2 > fabs(position.z - locations[index].z));
+
+		}
+		long is_on(glm::vec3 position) override {
+			// is_on_idx accepts anything between the player's feet (less a bit) and position
+			glm::vec3 lo(position.x - size.x/2, (player_position.y - player_height) - size.y/2 - 1.0f, position.z - size.z/2);
+			glm::vec3 hi(position.x + size.x/2, position.y, position.z + size.z/2);
+			return grid.query(lo, hi, [&](size_t i) { return is_on_idx(position, i); });
+		}
+		long collision_index(glm::vec3 position, float distance = 0){
+			return box_query(position, distance);
+		}
+		bool collision_boxes(aabb_soa& boxes) override {
+			boxes.clear();
+			for(glm::vec3 l : locations)
+				boxes.push(l, size / 2.0f);
+			return true;
+		}
+
+		/* Leaving y for later, so we finish today */
+		glm::vec3 collision_normal(glm::vec3 move_to, glm::vec3 old_position, long index, float distance = 0){
+			glm::vec3 l = locations[index]; // This'll get optimized out
+			if(	old_position.z > l.z + (size.z/2 + distance) &&
+					old_position.x >= l.x - (size.x/2 + distance) &&
+					old_position.x <= l.x + (size.x/2 + distance)){
+				return glm::vec3(0, 0, 1);
+			}
+			if(	old_position.z < l.z - (size.z/2 + distance) &&
+					old_position.x >= l.x - (size.x/2 + distance) &&
+					old_position.x <= l.x + (size.x/2 + distance)){
+				return glm::vec3(0, 0, -1);
+			}
+			if(	old_position.x < l.x - (size.x/2 + distance) &&
+					old_position.z >= l.z - (size.z/2 + distance) &&
+					old_position.z <= l.z + (size.z/2 + distance)){
+				return glm::vec3(1, 0, 0);
+			}
+			if(	old_position.x > l.x + (size.x/2 + distance) &&
+					old_position.z >= l.z - (size.z/2 + distance) &&
+					old_position.z <= l.z + (size.z/2 + distance)){
+				return glm::vec3(-1, 0, 0);
+			}
+			puts("Ended collision normal without returning");
+		}
+
+		bool collision_with_index(glm::vec3 position, size_t index, float distance = 0){
+                        glm::vec3 l = locations[index]; // This'll get optimized out
+                        if(     size.x/2.0f + distance > abs(l.x-position.x) &&
+                                size.y/2.0f + distance > abs(l.y-position.y) &&
+                                size.z/2.0f + distance > abs(l.z-position.z)){
+                                return true;
+                        }
+                        return false;
+
+                }
+
+};
+
+/* Projectiles have:
+ * 	speed
+ * 	direction
+ * 	lifespan
+ */
+class projectile : public loaded_object {
+public:
+	/* The simulation works on particles; locations is kept as a copy for collision and drawing */
+	particle_soa particles;
+	std::vector<uint8_t> expired;
+	std::mutex data_mutex;
+	bool shot_no_hit = false;
+	projectile() : loaded_object("projectile.obj", "projectile.jpg", glm::vec3(0.1, 0.1, 0.1)) {
+		collision_check = false;//check back here ?
+	}
+	void dont_hit_self() {
+		shot_no_hit = true;
+	}
+	bool is_on_idx(glm::vec3 position, size_t index) override { return false; }
+	long is_on(glm::vec3 position) override { return -1; }
+	void create_burst(float quantity, glm::vec3 origin, float speed){
+		for(size_t i = 0; i < quantity; i++){
+			add_location(origin);
+			// One note:  This does create a cube of projectiles
+			particles.push(origin, glm::vec3(randvel(speed), randvel(speed), randvel(speed)), 10000.0f, false);
+		}
+	}
+	void move() {
+		data_mutex.lock();
+		size_t count = particles.size();
+		expired.resize(count);
+		std::atomic<size_t> expiring(0);
+		jobs.parallel_for(0, count, JOB_GRAIN, [&](size_t lo, size_t hi) {
+			// TODO:  Manage time resolutions better
+			expiring += integrate_particles(particles, lo, hi, 0.02f, time_resolution, expired.data());
+			for(size_t i = lo; i < hi; i++)
+				locations[i] = particles.position(i);
+		});
+		for(size_t i = 0; i < count; i++)
+			grid.update(i, locations[i]);
+		// Expiring changes the arrays, so that part stays serial.  Walking backwards, whatever
+		// swap_pop moves into i has already been looked at (or is a fresh burst).
+		for(long i = (long)count - 1; expiring && i >= 0; i--){
+			if(expired[i]) {
+				if(particles.burst[i])
+					create_burst(200, locations[i], 0.003);
+				remove_projectile(i);
+				expiring--;
+			}
+		}
+		data_mutex.unlock();
+	}
+	void publish() override {
+		data_mutex.lock();
+		loaded_object::publish();
+		data_mutex.unlock();
+	}
+	void remove_projectile(size_t index){
+		particles.remove(index);
+		remove_location(index);
+	}
+	
+	void add_projectile(glm::vec3 location, glm::vec3 direction, float lifetime, bool burst = false){
+		data_mutex.lock();
+		add_location(location);
+		particles.push(location, direction, lifetime, burst);
+		data_mutex.unlock();
+	}
+	void add_projectile(glm::vec3 location, float heading, float elevation, float speed, float lifetime, float offset = 0.0f, bool burst = false){
+		glm::vec3 direction;
+		direction.x = cosf(elevation) * sinf(heading);
+		direction.y = sinf(elevation);
+		direction.z = cosf(elevation) * cosf(heading);
+		location += offset * direction;
+		if(!burst)
+			speed *= 2;
+		direction *= speed;
+		add_projectile(location, direction, lifetime, burst);
+	}
+	void hit_index(size_t idx){
+		particles.vx[idx] = particles.vy[idx] = particles.vz[idx] = 0;
+	}
+};
+
+extern projectile ice_balls;
+
+class fragment : public loaded_object {
+public:
+	std::vector<float> life_counts;
+	std::vector<glm::vec3> trajectories;
+	fragment() : loaded_object("projectile.obj", "brick.jpg", glm::vec3(1.0f, 1.0f, 1.0f)){
+		collision_check = false;
+		format = INSTANCE_QUAT;
+	}
+	
+	void create_burst(float quantity, glm::vec3 origin, float speed){
+		for(size_t i = 0; i < quantity; i++){
+			add_location(origin);
+			life_counts.push_back(1000.0f);
+			// One note:  This does create a cube of projectiles
+			trajectories.push_back(glm::vec3(randvel(speed), randvel(speed), randvel(speed)));
+		}
+	}
+
+	void move() {
+		size_t count = locations.size();
+		jobs.parallel_for(0, count, JOB_GRAIN, [this](size_t lo, size_t hi) { move_range(lo, hi); });
+		for(size_t i = 0; i < count; i++)
+			grid.update(i, locations[i]);
+	}
+	void move_range(size_t lo, size_t hi) {
+		for(size_t i = lo; i < hi; i++){
+			life_counts[i] -= 0.1f;
+			locations[i] += trajectories[i];
+			// Is it on the ground?
+			// Import player fall code to make this more elaborate and probably buggy
+			if(locations[i].y <= -9.0){
+				trajectories[i].y = fabs(trajectories[i].y);
+
+				if(fabs(trajectories[i].x) < 0.02)
+					trajectories[i].x = 0.0f;
+				else 
+					trajectories[i].x *= 0.95f;
+
+				if(trajectories[i].y < 0.2)
+					trajectories[i].y = 0.0f;
+				else
+					trajectories[i].y *= 0.8f;
+
+				if(fabs(trajectories[i].z) < 0.02)
+					trajectories[i].z = 0.0f;
+				else
+					trajectories[i].z *= 0.95f;
+
+			} else { 
+				trajectories[i].y -= 0.1;
+			}
+		}
+	}
+		/* Tumble around the horizontal axis perpendicular to the trajectory while moving */
+		void write_instances(char* dst, size_t count) override {
+			for(size_t i = 0; i < count; i++){
+				glm::vec3 axis(-trajectories[i].z, 0, trajectories[i].x);
+				bool spinning = fabs(trajectories[i].x) > 0.0f || fabs(trajectories[i].z) > 0.0f;
+				switch(format) {
+					case INSTANCE_QUAT: {
+						glm::vec4 rotation(0, 0, 0, 1);
+						if(spinning)
+							rotation = glm::vec4(glm::normalize(axis) * sinf(life_counts[i] / 2), cosf(life_counts[i] / 2));
+						((glm::vec4*)dst)[2*i] = glm::vec4(locations[i], 1.0f);
+						((glm::vec4*)dst)[2*i + 1] = rotation;
+						break;
+					}
+					case INSTANCE_VEC4: // Can't rotate
+						((glm::vec4*)dst)[i] = glm::vec4(locations[i], 1.0f);
+						break;
+					default: {
+						glm::mat4 new_model = glm::mat4(1.0f);
+						new_model = translate(new_model, locations[i]);
+						if(spinning)
+							new_model = rotate(new_model, life_counts[i], axis);
+						((glm::mat4*)dst)[i] = new_model;
+					}
+				}
+			}
+		}
+	
+};
+
+extern fragment brick_fragments;
+
+class target : public loaded_object {
+public:
+	target() : loaded_object("tex_cube.obj", "beans.jpg", glm::vec3(15.0f, 10.0f, 15.0f)) {
+		collision_check = true;
+	}
+	void hit_index(long index){
+		// Make fragments
+		brick_fragments.create_burst(100, locations[index], 0.01f);
+		remove_location(index);
+	}
+	
+};
+
+class elevator : public loaded_object {
+	public:
+		bool up = true;
+
+		elevator(const char* of, const char* tf, glm::vec3 s) : loaded_object(of, tf, s) {}
+		void move(){
+			// Just one elevator for now
+			if(up) {
+				set_location(0, locations[0] + glm::vec3(0, .1, 0));
+				if(locations[0].y > 100)
+					up = false;
+			} else {
+				set_location(0, locations[0] - glm::vec3(0, .1, 0));
+				if(locations[0].y <= 0)
+					up = true;
+			}
+		}
+};
+
+class turret : public loaded_object {
+public:
+	glm::vec3* player_target; //the player
+	projectile* current_projectile;
+	int countdown = 500;
+	const static int life = 10000;
+	int fire_freq = 0;
+	int p; //used to see which is the most recent for indexing for projectiles
+	
+	bool can_shoot = true;
+	bool not_shot = true;
+	bool movement = true;//not very good name since it'll move no matter what
+
+	turret() : loaded_object("cat.obj", "Cat_bump.jpg", glm::vec3(10, 25, 30)) {//this size isn't a big deal, just collision. Could change
+		collision_check = true;
+	
+	}//hit box is kind of in front of its feet
+	/*Check if got hit: use loaded object method?*/
+	void hit_index(long index) {
+		not_shot = false; // first projectile shot "hits" turret
+	}
+
+	int count = 0;
+	int count_down_count = 60; //i kinda hate these names
+	void move() {
+		if(countdown > 1){
+			countdown--;//Add back the '--', this is just for testing
+			return;
+		}
+		if (fire_freq == 0 && not_shot) {
+			//a weird but succesful way of making the turret not hit itself
+			current_projectile->add_projectile(locations[0] + glm::vec3(0, -25, 0), 0.01f * (*player_target - locations[0] + glm::vec3(0, 25, 0)), life);
+			//printf("%d\n", current_projectile->locations.size());
+
+			fire_freq = count_down_count;
+		}
+
+		/*Movement*/
+		if (movement && not_shot) {
+			set_location(0, locations[0] + glm::vec3(1, 0, 0));
+			if (locations[0].x > 200)
+				movement = false;
+		}
+		else if(!movement && not_shot){
+			set_location(0, locations[0] - glm::vec3(1, 0, 0));
+			if (locations[0].x < -100)
+				movement = true;
+		}
+
+		if (!not_shot && locations[0].y > -100) {
+			set_location(0, locations[0] - glm::vec3(0, 1, 0));
+		}
+
+		fire_freq--;
+
+		/*Check if hit player*/
+		//is messing around with globals in here a bad idea?
+		current_projectile->data_mutex.lock();
+		p = current_projectile->locations.size() - 1;
+		for (int i = 0; i < p; i++) {// should check if any of them hit the player
+			if (current_projectile->locations[i].x > player_position.x - 5 && current_projectile->locations[i].x < player_position.x + 5
+				&& current_projectile->locations[i].z > player_position.z - 5 && current_projectile->locations[i].z < player_position.z + 5
+				&& current_projectile->locations[i].y > player_position.y - 5 && current_projectile->locations[i].y < player_position.y + 5) {
+				if (player_speed <= 0.1f)
+					player_dead = true;// could do something cooler here
+				if (!player_dead) {
+					player_speed -= 0.1f;
+					printf("Current player speed : % f\n", player_speed);
+				}
+				puts("Player Hit!");
+				current_projectile->remove_projectile(i);
+				break;
+			}
+		}
+		current_projectile->data_mutex.unlock();
+		if (player_dead) {
+			not_shot = false; // not nessesarily shot, but don't want it to shoot
+			set_location(0, player_position + glm::vec3(0, 40, -20));
+		}
+
+		//some weird stuff to make turret gradually speed up shooting
+		if (count == 100) {
+			count = 0;
+			count_down_count -= 1;
+			//this will eventually go down to 0, which will prevent it from shooting
+			//keep for now, cool feature!!
+		}
+		else
+			count++;
+
+
+	}
+	
+};
+
+void fire(bool burst = false);
+long is_empty(glm::vec3 position, float distance);
+
+/* Simulation phases.  Each is one tick's worth of work, run in order by a tick_scheduler. */
+void player_movement();
+void object_movement();
+void animation();
+void collision_detection();
+void publish();
+/* All of the above, at their usual periods */
+void add_sim_phases(tick_scheduler& scheduler);
+
+#endif
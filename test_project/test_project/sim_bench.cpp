@@ -0,0 +1,83 @@
+/* Runs the simulation on its own, no window or GL, as fast as it'll go.
+ * Build with "make sim_bench", run "./sim_bench [ticks] [targets]".  Built with
+ * DEFINES=-DPROFILE it also writes sim_trace.json, see profiler.h.  Tick and phase time
+ * percentiles go in sim_latency.csv.
+ * The scene is generated:  a block of targets in front of the player, who sweeps back and forth
+ * firing at them, with a burst now and then, while the turret fires back.  Every run with the same
+ * arguments does the same work.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<chrono>
+#include "sim.h"
+
+target targets;
+loaded_object platform("tex_cube.obj", "beans.jpg", glm::vec3(10, 10, 10));
+turret t;
+
+/* Rows of 15, 20 apart, going back from z = -100 like the level's row */
+void make_scene(int target_count) {
+	player_position = glm::vec3(53, 10, 50);
+	player_heading = M_PI;
+	for(int i = 0; i < target_count; i++)
+		targets.add_location(glm::vec3(-100 + 20 * (i % 15), 0, -100 - 20 * (i / 15)));
+	platform.add_location(glm::vec3(0, 0, -60));
+	t.add_location(glm::vec3(100, 30, 100));
+	t.player_target = &player_position;
+	t.current_projectile = &ice_balls;
+
+	objects.push_back(&ice_balls);
+	objects.push_back(&targets);
+	objects.push_back(&platform);
+	objects.push_back(&t);
+	objects.push_back(&brick_fragments);	// Not in the level yet, but it's most of the work once targets are hit
+}
+
+/* Stands in for the keyboard and mouse:  sweep half a radian either side of the targets, strafing
+ * every 1000 ticks, firing every 20 and a burst every 500
+ */
+unsigned long input_tick = 0;
+void input() {
+	player_heading = M_PI + 0.5f * sinf(input_tick * 0.002f);
+	player_key_status.left = (input_tick / 1000) % 4 == 1;
+	player_key_status.right = (input_tick / 1000) % 4 == 3;
+	if(input_tick % 500 == 0)
+		fire(true);
+	else if(input_tick % 20 == 0)
+		fire();
+	input_tick++;
+}
+
+int main(int argc, char** argv) {
+	srand(1234);
+	unsigned long ticks = argc > 1 ? strtoul(argv[1], 0, 10) : 10000;
+	int target_count = argc > 2 ? atoi(argv[2]) : 300;
+
+	PROFILE_THREAD("simulation");
+	jobs.start();
+	make_scene(target_count);
+
+	tick_scheduler scheduler;
+	scheduler.add_phase("input", input);
+	add_sim_phases(scheduler);
+
+	auto start = std::chrono::steady_clock::now();
+	for(unsigned long i = 0; i < ticks; i++)
+		scheduler.tick();
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("%lu ticks in %.1f ms on %u workers:  %.0f ticks/s, %.4f ms/tick\n", ticks, ms, jobs.worker_count(), 1000.0 * ticks / ms, ms / ticks);
+	jobs.stop();
+
+	printf("Left:  %zu targets, %zu projectiles, %zu fragments\n", targets.locations.size(), ice_balls.locations.size(), brick_fragments.locations.size());
+	scheduler.print_stats();
+	FILE* f = fopen("sim_latency.csv", "w");
+	if(f) {
+		hdr_histogram::csv_header(f);
+		scheduler.write_csv(f);
+		fclose(f);
+	}
+	PROFILE_WRITE_TRACE("sim_trace.json");
+	return 0;
+}
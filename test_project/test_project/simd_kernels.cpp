@@ -0,0 +1,379 @@
+#include<string.h>
+#include<math.h>
+#include<algorithm>
+#include "simd_kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include<immintrin.h>
+#ifdef _MSC_VER
+#include<intrin.h>
+#endif
+#endif
+
+/* GCC and clang only emit AVX2 instructions in functions marked for it.  MSVC doesn't need this. */
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+static inline int popcount(int mask) {
+	int count = 0;
+	for(; mask; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+/* Scalar versions.  These handle the tails of the vector loops too. */
+
+static size_t integrate_scalar(particle_soa& p, size_t lo, size_t hi, float gravity, float life_step, uint8_t* expired) {
+	size_t count = 0;
+	for(size_t i = lo; i < hi; i++) {
+		if(p.burst[i])
+			p.vy[i] -= gravity;
+		p.x[i] += p.vx[i];
+		p.y[i] += p.vy[i];
+		p.z[i] += p.vz[i];
+		p.life[i] -= life_step;
+		expired[i] = p.life[i] <= 0.0f;
+		count += expired[i];
+	}
+	return count;
+}
+
+/* Boxes [lo, hi) against one point, bits set from bit 0 for box lo */
+static uint32_t aabb_mask_scalar(const aabb_soa& b, glm::vec3 p, size_t lo, size_t hi) {
+	uint32_t mask = 0;
+	for(size_t i = lo; i < hi; i++)
+		if(	b.hx[i] > fabsf(b.cx[i] - p.x) &&
+				b.hy[i] > fabsf(b.cy[i] - p.y) &&
+				b.hz[i] > fabsf(b.cz[i] - p.z))
+			mask |= 1u << (i - lo);
+	return mask;
+}
+
+static void aabb_masks_scalar(const aabb_soa& b, glm::vec3 p, uint8_t* masks) {
+	for(size_t g = 0; g * 8 < b.size(); g++)
+		masks[g] = aabb_mask_scalar(b, p, g * 8, std::min(g * 8 + 8, b.size()));
+}
+
+static size_t cull_scalar(const char* instances, size_t lo, size_t hi, size_t stride, float radius, const glm::vec4* planes, uint32_t* visible) {
+	size_t n = 0;
+	for(size_t i = lo; i < hi; i++) {
+		float c[4];
+		memcpy(c, instances + i * stride, sizeof(c));
+		float r = -radius * c[3];
+		bool in = true;
+		for(int k = 0; k < 6 && in; k++)
+			in = planes[k].x * c[0] + planes[k].y * c[1] + planes[k].z * c[2] + planes[k].w > r;
+		if(in)
+			visible[n++] = i;
+	}
+	return n;
+}
+
+static size_t cull_spheres_scalar(const char* instances, size_t count, size_t stride, float radius, const glm::vec4* planes, uint32_t* visible) {
+	return cull_scalar(instances, 0, count, stride, radius, planes, visible);
+}
+
+#ifdef SIMD_X86
+
+/* |centre - point| < half for 4 boxes, as a 4 bit mask */
+static inline int aabb_test4(const aabb_soa& b, size_t i, __m128 px, __m128 py, __m128 pz, __m128 abs_mask) {
+	__m128 dx = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(&b.cx[i]), px), abs_mask);
+	__m128 dy = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(&b.cy[i]), py), abs_mask);
+	__m128 dz = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(&b.cz[i]), pz), abs_mask);
+	__m128 in = _mm_and_ps(_mm_cmplt_ps(dx, _mm_loadu_ps(&b.hx[i])),
+			_mm_and_ps(_mm_cmplt_ps(dy, _mm_loadu_ps(&b.hy[i])), _mm_cmplt_ps(dz, _mm_loadu_ps(&b.hz[i]))));
+	return _mm_movemask_ps(in);
+}
+
+static void aabb_masks_sse2(const aabb_soa& b, glm::vec3 p, uint8_t* masks) {
+	__m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+	__m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	size_t n = b.size(), g = 0;
+	for(; g * 8 + 8 <= n; g++)
+		masks[g] = aabb_test4(b, g * 8, px, py, pz, abs_mask) | (aabb_test4(b, g * 8 + 4, px, py, pz, abs_mask) << 4);
+	if(g * 8 < n)
+		masks[g] = aabb_mask_scalar(b, p, g * 8, n);
+}
+
+TARGET_AVX2
+static void aabb_masks_avx2(const aabb_soa& b, glm::vec3 p, uint8_t* masks) {
+	__m256 px = _mm256_set1_ps(p.x), py = _mm256_set1_ps(p.y), pz = _mm256_set1_ps(p.z);
+	__m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	size_t n = b.size(), g = 0;
+	for(; g * 8 + 8 <= n; g++) {
+		size_t i = g * 8;
+		__m256 dx = _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(&b.cx[i]), px), abs_mask);
+		__m256 dy = _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(&b.cy[i]), py), abs_mask);
+		__m256 dz = _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(&b.cz[i]), pz), abs_mask);
+		__m256 in = _mm256_and_ps(_mm256_cmp_ps(dx, _mm256_loadu_ps(&b.hx[i]), _CMP_LT_OQ),
+				_mm256_and_ps(_mm256_cmp_ps(dy, _mm256_loadu_ps(&b.hy[i]), _CMP_LT_OQ),
+					_mm256_cmp_ps(dz, _mm256_loadu_ps(&b.hz[i]), _CMP_LT_OQ)));
+		masks[g] = _mm256_movemask_ps(in);
+	}
+	if(g * 8 < n)
+		masks[g] = aabb_mask_scalar(b, p, g * 8, n);
+}
+
+static size_t integrate_sse2(particle_soa& p, size_t lo, size_t hi, float gravity, float life_step, uint8_t* expired) {
+	__m128 g = _mm_set1_ps(gravity), step = _mm_set1_ps(life_step), zero = _mm_setzero_ps();
+	__m128i zero_i = _mm_setzero_si128();
+	size_t count = 0, i = lo;
+	for(; i + 4 <= hi; i += 4) {
+		// 4 burst bytes widened to 4 lanes, all ones where set
+		int32_t b;
+		memcpy(&b, &p.burst[i], 4);
+		__m128i bi = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(b), zero_i), zero_i);
+		__m128 falling = _mm_castsi128_ps(_mm_cmpgt_epi32(bi, zero_i));
+
+		__m128 vy = _mm_sub_ps(_mm_loadu_ps(&p.vy[i]), _mm_and_ps(falling, g));
+		_mm_storeu_ps(&p.vy[i], vy);
+		_mm_storeu_ps(&p.x[i], _mm_add_ps(_mm_loadu_ps(&p.x[i]), _mm_loadu_ps(&p.vx[i])));
+		_mm_storeu_ps(&p.y[i], _mm_add_ps(_mm_loadu_ps(&p.y[i]), vy));
+		_mm_storeu_ps(&p.z[i], _mm_add_ps(_mm_loadu_ps(&p.z[i]), _mm_loadu_ps(&p.vz[i])));
+		__m128 life = _mm_sub_ps(_mm_loadu_ps(&p.life[i]), step);
+		_mm_storeu_ps(&p.life[i], life);
+
+		int dead = _mm_movemask_ps(_mm_cmple_ps(life, zero));
+		for(int k = 0; k < 4; k++)
+			expired[i + k] = (dead >> k) & 1;
+		count += popcount(dead);
+	}
+	return count + integrate_scalar(p, i, hi, gravity, life_step, expired);
+}
+
+TARGET_AVX2
+static size_t integrate_avx2(particle_soa& p, size_t lo, size_t hi, float gravity, float life_step, uint8_t* expired) {
+	__m256 g = _mm256_set1_ps(gravity), step = _mm256_set1_ps(life_step), zero = _mm256_setzero_ps();
+	size_t count = 0, i = lo;
+	for(; i + 8 <= hi; i += 8) {
+		__m256i bi = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&p.burst[i]));
+		__m256 falling = _mm256_castsi256_ps(_mm256_cmpgt_epi32(bi, _mm256_setzero_si256()));
+
+		__m256 vy = _mm256_sub_ps(_mm256_loadu_ps(&p.vy[i]), _mm256_and_ps(falling, g));
+		_mm256_storeu_ps(&p.vy[i], vy);
+		_mm256_storeu_ps(&p.x[i], _mm256_add_ps(_mm256_loadu_ps(&p.x[i]), _mm256_loadu_ps(&p.vx[i])));
+		_mm256_storeu_ps(&p.y[i], _mm256_add_ps(_mm256_loadu_ps(&p.y[i]), vy));
+		_mm256_storeu_ps(&p.z[i], _mm256_add_ps(_mm256_loadu_ps(&p.z[i]), _mm256_loadu_ps(&p.vz[i])));
+		__m256 life = _mm256_sub_ps(_mm256_loadu_ps(&p.life[i]), step);
+		_mm256_storeu_ps(&p.life[i], life);
+
+		int dead = _mm256_movemask_ps(_mm256_cmp_ps(life, zero, _CMP_LE_OQ));
+		for(int k = 0; k < 8; k++)
+			expired[i + k] = (dead >> k) & 1;
+		count += popcount(dead);
+	}
+	return count + integrate_scalar(p, i, hi, gravity, life_step, expired);
+}
+
+/* 4 instances at a time:  load each one's leading vec4 and transpose to x, y, z, scale lanes */
+static size_t cull_spheres_sse2(const char* instances, size_t count, size_t stride, float radius, const glm::vec4* planes, uint32_t* visible) {
+	__m128 px[6], py[6], pz[6], pw[6];
+	for(int k = 0; k < 6; k++) {
+		px[k] = _mm_set1_ps(planes[k].x);
+		py[k] = _mm_set1_ps(planes[k].y);
+		pz[k] = _mm_set1_ps(planes[k].z);
+		pw[k] = _mm_set1_ps(planes[k].w);
+	}
+	__m128 neg_radius = _mm_set1_ps(-radius);
+	size_t n = 0, i = 0;
+	for(; i + 4 <= count; i += 4) {
+		const char* base = instances + i * stride;
+		__m128 x = _mm_loadu_ps((const float*)base);
+		__m128 y = _mm_loadu_ps((const float*)(base + stride));
+		__m128 z = _mm_loadu_ps((const float*)(base + 2 * stride));
+		__m128 w = _mm_loadu_ps((const float*)(base + 3 * stride));
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		__m128 r = _mm_mul_ps(w, neg_radius);
+		__m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for(int k = 0; k < 6; k++) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[k], x), _mm_mul_ps(py[k], y)), _mm_add_ps(_mm_mul_ps(pz[k], z), pw[k]));
+			in = _mm_and_ps(in, _mm_cmpgt_ps(d, r));
+		}
+		for(int mask = _mm_movemask_ps(in); mask; mask &= mask - 1) {
+			int bit = 0;
+			while(!(mask >> bit & 1))
+				bit++;
+			visible[n++] = i + bit;
+		}
+	}
+	return n + cull_scalar(instances, i, count, stride, radius, planes, visible + n);
+}
+
+/* 8 at a time, instances 0-3 in the low lane and 4-7 in the high one */
+TARGET_AVX2
+static size_t cull_spheres_avx2(const char* instances, size_t count, size_t stride, float radius, const glm::vec4* planes, uint32_t* visible) {
+	__m256 px[6], py[6], pz[6], pw[6];
+	for(int k = 0; k < 6; k++) {
+		px[k] = _mm256_set1_ps(planes[k].x);
+		py[k] = _mm256_set1_ps(planes[k].y);
+		pz[k] = _mm256_set1_ps(planes[k].z);
+		pw[k] = _mm256_set1_ps(planes[k].w);
+	}
+	__m256 neg_radius = _mm256_set1_ps(-radius);
+	size_t n = 0, i = 0;
+	for(; i + 8 <= count; i += 8) {
+		__m256 rows[4];
+		for(int k = 0; k < 4; k++) {
+			const float* lo = (const float*)(instances + (i + k) * stride);
+			const float* hi = (const float*)(instances + (i + k + 4) * stride);
+			rows[k] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+		}
+		__m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]), t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+		__m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]), t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+		__m256 x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 w = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 r = _mm256_mul_ps(w, neg_radius);
+		__m256 in = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for(int k = 0; k < 6; k++) {
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[k], x), _mm256_mul_ps(py[k], y)), _mm256_add_ps(_mm256_mul_ps(pz[k], z), pw[k]));
+			in = _mm256_and_ps(in, _mm256_cmp_ps(d, r, _CMP_GT_OQ));
+		}
+		for(int mask = _mm256_movemask_ps(in); mask; mask &= mask - 1) {
+			int bit = 0;
+			while(!(mask >> bit & 1))
+				bit++;
+			visible[n++] = i + bit;
+		}
+	}
+	return n + cull_scalar(instances, i, count, stride, radius, planes, visible + n);
+}
+
+static bool cpu_has_avx2() {
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = info[2] & (1 << 27);
+	bool avx = info[2] & (1 << 28);
+	if(!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return info[1] & (1 << 5);
+#else
+	return false;
+#endif
+}
+
+#endif // SIMD_X86
+
+typedef size_t (*integrate_fn)(particle_soa&, size_t, size_t, float, float, uint8_t*);
+typedef void (*aabb_masks_fn)(const aabb_soa&, glm::vec3, uint8_t*);
+typedef size_t (*cull_fn)(const char*, size_t, size_t, float, const glm::vec4*, uint32_t*);
+
+static simd_level detect() {
+#ifdef SIMD_X86
+	return cpu_has_avx2() ? SIMD_AVX2 : SIMD_SSE2;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+static integrate_fn integrate_for(simd_level level) {
+	switch(level) {
+#ifdef SIMD_X86
+		case SIMD_AVX2:	return integrate_avx2;
+		case SIMD_SSE2:	return integrate_sse2;
+#endif
+		default:	return integrate_scalar;
+	}
+}
+
+static aabb_masks_fn aabb_masks_for(simd_level level) {
+	switch(level) {
+#ifdef SIMD_X86
+		case SIMD_AVX2:	return aabb_masks_avx2;
+		case SIMD_SSE2:	return aabb_masks_sse2;
+#endif
+		default:	return aabb_masks_scalar;
+	}
+}
+
+static cull_fn cull_for(simd_level level) {
+	switch(level) {
+#ifdef SIMD_X86
+		case SIMD_AVX2:	return cull_spheres_avx2;
+		case SIMD_SSE2:	return cull_spheres_sse2;
+#endif
+		default:	return cull_spheres_scalar;
+	}
+}
+
+static simd_level detected = detect();
+static simd_level active = detected;
+static integrate_fn integrate_impl = integrate_for(detected);
+static aabb_masks_fn aabb_masks_impl = aabb_masks_for(detected);
+static cull_fn cull_impl = cull_for(detected);
+
+simd_level detected_simd_level() { return detected; }
+simd_level current_simd_level() { return active; }
+
+/* Not thread safe, call before the kernels are in use */
+void use_simd_level(simd_level level) {
+	active = level > detected ? detected : level;
+	integrate_impl = integrate_for(active);
+	aabb_masks_impl = aabb_masks_for(active);
+	cull_impl = cull_for(active);
+}
+
+const char* simd_level_name(simd_level level) {
+	switch(level) {
+		case SIMD_AVX2:	return "avx2";
+		case SIMD_SSE2:	return "sse2";
+		default:	return "scalar";
+	}
+}
+
+size_t integrate_particles(particle_soa& p, size_t lo, size_t hi, float gravity, float life_step, uint8_t* expired) {
+	return integrate_impl(p, lo, hi, gravity, life_step, expired);
+}
+
+void aabb_hit_masks(const aabb_soa& boxes, glm::vec3 point, uint8_t* masks) {
+	aabb_masks_impl(boxes, point, masks);
+}
+
+void aabb_first_hits(const aabb_soa& boxes, const glm::vec3* points, size_t n, long* first_hit) {
+	size_t groups = (boxes.size() + 7) / 8;
+	uint8_t stack_masks[AABB_STACK_BOXES / 8];
+	std::vector<uint8_t> heap_masks;
+	uint8_t* masks = stack_masks;
+	if(groups > AABB_STACK_BOXES / 8) {
+		heap_masks.resize(groups);
+		masks = heap_masks.data();
+	}
+	for(size_t q = 0; q < n; q++) {
+		aabb_masks_impl(boxes, points[q], masks);
+		first_hit[q] = -1;
+		for(size_t g = 0; g < groups; g++)
+			if(masks[g]) {
+				int bit = 0;
+				while(!(masks[g] >> bit & 1))
+					bit++;
+				first_hit[q] = g * 8 + bit;
+				break;
+			}
+	}
+}
+
+void frustum_planes(const glm::mat4& vp, glm::vec4 planes[6]) {
+	// Gribb and Hartmann:  each plane is the last row of vp plus or minus one of the others
+	glm::vec4 rows[4];
+	for(int r = 0; r < 4; r++)
+		rows[r] = glm::vec4(vp[0][r], vp[1][r], vp[2][r], vp[3][r]);
+	for(int k = 0; k < 6; k++) {
+		glm::vec4 p = k & 1 ? rows[3] - rows[k / 2] : rows[3] + rows[k / 2];
+		float length = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+		planes[k] = p / length;
+	}
+}
+
+size_t cull_spheres(const void* instances, size_t count, size_t stride, float radius, const glm::vec4 planes[6], uint32_t* visible) {
+	return cull_impl((const char*)instances, count, stride, radius, planes, visible);
+}
@@ -0,0 +1,91 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include<glm/glm.hpp>
+#include<vector>
+#include<cstdint>
+#include<cstddef>
+#include "instance_handles.h"
+
+/* Vectorised batch loops for the simulation.
+ * Each kernel has an AVX2, an SSE2 and a scalar version.  The best one the CPU supports is
+ * picked at startup; use_simd_level can force a lower one (for benchmarking).
+ */
+enum simd_level {
+	SIMD_SCALAR,
+	SIMD_SSE2,
+	SIMD_AVX2,
+};
+simd_level detected_simd_level();
+simd_level current_simd_level();
+void use_simd_level(simd_level level);
+const char* simd_level_name(simd_level level);
+
+/* Particles stored structure-of-arrays so kernels can load 4 or 8 of each field at once */
+struct particle_soa {
+	std::vector<float> x, y, z;
+	std::vector<float> vx, vy, vz;
+	std::vector<float> life;
+	std::vector<uint8_t> burst;
+
+	size_t size() const { return x.size(); }
+	glm::vec3 position(size_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+	void push(glm::vec3 p, glm::vec3 v, float l, bool b) {
+		x.push_back(p.x); y.push_back(p.y); z.push_back(p.z);
+		vx.push_back(v.x); vy.push_back(v.y); vz.push_back(v.z);
+		life.push_back(l);
+		burst.push_back(b);
+	}
+	void remove(size_t i) {
+		swap_pop(x, i); swap_pop(y, i); swap_pop(z, i);
+		swap_pop(vx, i); swap_pop(vy, i); swap_pop(vz, i);
+		swap_pop(life, i);
+		swap_pop(burst, i);
+	}
+};
+
+/* Advances particles [lo, hi):  burst particles fall by gravity, everything moves by its
+ * velocity and loses life_step of life.  expired[i] is set to 1 where life ran out, 0 elsewhere.
+ * Returns how many expired.
+ */
+size_t integrate_particles(particle_soa& p, size_t lo, size_t hi, float gravity, float life_step, uint8_t* expired);
+
+/* Axis aligned boxes stored structure-of-arrays:  centres and half extents */
+struct aabb_soa {
+	std::vector<float> cx, cy, cz;
+	std::vector<float> hx, hy, hz;
+
+	size_t size() const { return cx.size(); }
+	void clear() {
+		cx.clear(); cy.clear(); cz.clear();
+		hx.clear(); hy.clear(); hz.clear();
+	}
+	void push(glm::vec3 centre, glm::vec3 half) {
+		cx.push_back(centre.x); cy.push_back(centre.y); cz.push_back(centre.z);
+		hx.push_back(half.x); hy.push_back(half.y); hz.push_back(half.z);
+	}
+};
+
+/* Bit k of masks[g] is set if point is strictly inside box 8*g + k, the same test as
+ * collision_index.  masks needs (boxes.size() + 7) / 8 entries.
+ */
+void aabb_hit_masks(const aabb_soa& boxes, glm::vec3 point, uint8_t* masks);
+
+/* For each of n points, the lowest index of a box containing it, or -1.  With up to
+ * AABB_STACK_BOXES boxes its masks are on the stack, so it never allocates.
+ */
+#define AABB_STACK_BOXES 512
+void aabb_first_hits(const aabb_soa& boxes, const glm::vec3* points, size_t n, long* first_hit);
+
+/* The six planes of vp's view frustum, normals pointing in and normalised, so
+ * dot(plane.xyz, p) + plane.w is the signed distance of p from each
+ */
+void frustum_planes(const glm::mat4& vp, glm::vec4 planes[6]);
+
+/* Sphere culling for instances stored stride bytes apart, each starting with a vec4 of centre
+ * xyz and scale w, so instance i has radius w * radius.  Writes the indices of those at least
+ * partly inside all six planes to visible (count entries) in order and returns how many.
+ */
+size_t cull_spheres(const void* instances, size_t count, size_t stride, float radius, const glm::vec4 planes[6], uint32_t* visible);
+
+#endif
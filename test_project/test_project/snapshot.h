@@ -0,0 +1,61 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include<atomic>
+#include<vector>
+#include<cstddef>
+#include<glm/glm.hpp>
+
+/* Lock-free triple buffer with one writer and one reader.
+ * The writer fills its back slot and publishes it by swapping it with the middle slot.  The
+ * reader takes the middle slot, if it's newer than what it has, by swapping it with its front.
+ * Neither side ever waits on the other, and the reader always sees a complete slot.
+ */
+template<typename T>
+class triple_buffer {
+	public:
+		/* Writer side */
+		T& write_slot() { return slots[back]; }
+		void publish() {
+			back = middle.exchange(back | FRESH) & INDEX;
+		}
+
+		/* Reader side.  latest() picks up anything newly published, current() doesn't. */
+		const T& latest() {
+			if(middle.load() & FRESH)
+				front = middle.exchange(front) & INDEX;
+			return slots[front];
+		}
+		const T& current() const { return slots[front]; }
+
+	private:
+		static const int INDEX = 3;
+		static const int FRESH = 4;
+		T slots[3] = {};
+		int back = 0, front = 2;
+		std::atomic<int> middle{1};
+};
+
+/* What a loaded_object ships to the vertex shader per instance */
+enum instance_format {
+	INSTANCE_MAT4,	// full model matrix, 64 bytes
+	INSTANCE_VEC4,	// position + uniform scale, 16 bytes
+	INSTANCE_QUAT,	// position + uniform scale, then a rotation quaternion, 32 bytes
+	INSTANCE_FORMATS
+};
+
+inline size_t instance_stride(instance_format format) {
+	switch(format) {
+		case INSTANCE_VEC4:	return sizeof(glm::vec4);
+		case INSTANCE_QUAT:	return 2 * sizeof(glm::vec4);
+		default:		return sizeof(glm::mat4);
+	}
+}
+
+/* One object's instances as of one tick, already in the layout draw() uploads */
+struct instance_snapshot {
+	std::vector<char> data;
+	size_t count = 0;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include<glm/glm.hpp>
+#include<vector>
+#include<unordered_map>
+#include<cstdint>
+#include<cmath>
+
+/* Smallest cell we'll use.  Tiny objects (projectiles) would otherwise get cells so small that
+ * a player-sized query touches hundreds of them.
+ */
+#define GRID_MIN_CELL 4.0f
+
+/* Uniform spatial hash over a gameobject's locations.
+ * Each cell holds indices into the owner's locations vector, so a query only looks at the
+ * instances in the cells its box overlaps instead of scanning everything.
+ * The owner is responsible for telling the grid when a location moves or goes away.
+ */
+class spatial_grid {
+	public:
+		float cell_size = 0.0f; // 0 means not built
+
+		bool built() const { return cell_size > 0.0f; }
+		size_t size() const { return count; }
+
+		void clear() {
+			cells.clear();
+			keys.clear();
+			count = 0;
+			cell_size = 0.0f;
+		}
+
+		void build(const std::vector<glm::vec3>& points, float cs) {
+			clear();
+			cell_size = cs;
+			for(size_t i = 0; i < points.size(); i++)
+				insert(i, points[i]);
+		}
+
+		/* Indices have to be inserted in order, 0, 1, 2... */
+		void insert(size_t index, glm::vec3 p) {
+			uint64_t k = key(p);
+			cells[k].push_back((uint32_t)index);
+			keys.push_back(k);
+			count++;
+		}
+
+		/* Only touches the buckets if the point actually changed cells */
+		void update(size_t index, glm::vec3 new_p) {
+			if(!built() || index >= count)
+				return;
+			uint64_t new_key = key(new_p);
+			if(keys[index] == new_key)
+				return;
+			take_out(keys[index], index);
+			cells[new_key].push_back((uint32_t)index);
+			keys[index] = new_key;
+		}
+
+		/* For owners that swap_pop:  index goes away and the last location, now at last_p,
+		 * moves into it.  Works whether or not the last location has been inserted yet.
+		 */
+		void remove(size_t index, size_t last, glm::vec3 last_p) {
+			if(!built() || index >= count)
+				return;
+			take_out(keys[index], index);
+			if(last < count) {
+				if(last != index) {
+					take_out(keys[last], last);
+					cells[keys[last]].push_back((uint32_t)index);
+					keys[index] = keys[last];
+				}
+				keys.pop_back();
+				count--;
+			} else {
+				uint64_t k = key(last_p);
+				cells[k].push_back((uint32_t)index);
+				keys[index] = k;
+			}
+		}
+
+		/* Calls test(i) for every index in the cells overlapping [lo, hi] and returns the
+		 * lowest index it accepted, or -1.  Lowest index keeps results identical to a linear scan.
+		 */
+		template<typename F>
+		long query(glm::vec3 lo, glm::vec3 hi, F test) const {
+			long found = -1;
+			if(!built())
+				return found;
+			int64_t x0 = coord(lo.x), x1 = coord(hi.x);
+			int64_t y0 = coord(lo.y), y1 = coord(hi.y);
+			int64_t z0 = coord(lo.z), z1 = coord(hi.z);
+			if(x1 < x0 || y1 < y0 || z1 < z0)
+				return -1;
+			// Huge boxes would walk more cells than we have, so just walk the buckets
+			double span = double(x1 - x0 + 1) * double(y1 - y0 + 1) * double(z1 - z0 + 1);
+			if(span > cells.size()) {
+				for(auto& c : cells)
+					scan(c.second, test, found);
+				return found;
+			}
+			for(int64_t x = x0; x <= x1; x++)
+				for(int64_t y = y0; y <= y1; y++)
+					for(int64_t z = z0; z <= z1; z++) {
+						auto c = cells.find(pack(x, y, z));
+						if(c != cells.end())
+							scan(c->second, test, found);
+					}
+			return found;
+		}
+
+	private:
+		std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+		std::vector<uint64_t> keys;	// which cell each index is in
+		size_t count = 0;
+
+		int64_t coord(float v) const {
+			return (int64_t)std::floor(v / cell_size);
+		}
+		/* 21 bits per axis, which wraps around after ~1M cells.  Wrapping only costs extra tests. */
+		static uint64_t pack(int64_t x, int64_t y, int64_t z) {
+			const uint64_t mask = (1ull << 21) - 1;
+			return ((uint64_t)x & mask) | (((uint64_t)y & mask) << 21) | (((uint64_t)z & mask) << 42);
+		}
+		uint64_t key(glm::vec3 p) const {
+			return pack(coord(p.x), coord(p.y), coord(p.z));
+		}
+		void take_out(uint64_t k, size_t index) {
+			auto c = cells.find(k);
+			if(c == cells.end())
+				return;
+			std::vector<uint32_t>& v = c->second;
+			for(size_t i = 0; i < v.size(); i++)
+				if(v[i] == index) {
+					v[i] = v.back();
+					v.pop_back();
+					break;
+				}
+			if(v.empty())
+				cells.erase(c);
+		}
+		template<typename F>
+		static void scan(const std::vector<uint32_t>& v, F& test, long& found) {
+			for(uint32_t i : v)
+				if((found == -1 || (long)i < found) && test(i))
+					found = i;
+		}
+};
+
+#endif
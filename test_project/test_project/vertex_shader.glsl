@@ -5,7 +5,6 @@ in vec3 in_color;
 uniform mat4 mvp;
 uniform mat4 animation;
 out vec4 fcolor;
-out vec4 gl_Position;
 
 void main(void) {
 	vec4 tmp = animation * vec4(in_vertex, 1.0);